@@ -0,0 +1,229 @@
+import argparse
+import hashlib
+import json
+import os
+import re
+import socket
+import socketserver
+import subprocess
+import threading
+
+from tidy_cache import header_tree, header_tree_version
+
+
+PREAMBLE_DIR = ".cache/preamble"
+SOCKET_PATH = ".cache/analysis.sock"
+# `-checks=-*` alone is rejected ("no checks enabled"); the clang-diagnostic-*
+# pseudo-checks keep just the compiler's own errors and warnings.
+SYNTAX_CHECKS = "-*,clang-diagnostic-*"
+ERROR = re.compile(r":\d+:\d+:\s+(?:fatal )?error:")
+
+
+def extract_preamble(code):
+    # Same idea as clangd's preamble: the leading run of comments and
+    # preprocessor directives (the #include block) before the first token of
+    # real code. Re-executing it after loading the PCH is a no-op because of
+    # include guards and identical macro redefinitions.
+    lines = code.split("\n")
+    end = 0
+    includes = False
+    in_comment = False
+    continued = False
+    for n, line in enumerate(lines):
+        stripped = line.strip()
+        if in_comment:
+            in_comment = "*/" not in stripped
+        elif continued or stripped.startswith("#"):
+            continued = stripped.endswith("\\")
+            includes = includes or re.match(r"#\s*include\b", stripped) is not None
+            end = n + 1
+        elif stripped.startswith("/*"):
+            in_comment = "*/" not in stripped
+        elif stripped and not stripped.startswith("//"):
+            break
+    return "\n".join(lines[:end]) + "\n" if includes else ""
+
+
+def pch_flags(arguments, source):
+    flags = []
+    skip = False
+    for arg in arguments[1:]:
+        if skip:
+            skip = False
+        elif arg == "-o":
+            skip = True
+        elif arg in ("-c", source) or arg.startswith("-Wp,-MMD"):
+            continue
+        else:
+            flags.append(arg)
+    return flags
+
+
+class PreambleCache:
+    # Precompiled headers keyed by the driver's preamble text, compile flags
+    # and kernel header tree. They stay on disk across requests and restarts,
+    # so each analysis only parses the generated driver body.
+    def __init__(self, root=PREAMBLE_DIR, clang="clang"):
+        self.root = root
+        self.clang = clang
+        self.lock = threading.Lock()
+        self.building = {}
+        self.failed = set()
+        self.trees = {}
+        os.makedirs(root, exist_ok=True)
+
+    def _tree_version(self, root):
+        if root not in self.trees:
+            self.trees[root] = header_tree_version(root)
+        return self.trees[root]
+
+    def _build(self, preamble, flags, pch):
+        header = pch[:-len(".pch")] + ".h"
+        with open(header, 'w') as f:
+            f.write(preamble)
+        staging = pch + f".{os.getpid()}.{threading.get_ident()}"
+        cmd = [self.clang, "-x", "c-header", *flags, header, "-o", staging]
+        out = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True, check=False)
+        if out.returncode != 0:
+            if os.path.exists(staging):
+                os.remove(staging)
+            return False
+        os.replace(staging, pch)
+        return True
+
+    def get(self, source, build_dir, extra_args):
+        with open(source, 'r') as f:
+            preamble = extract_preamble(f.read())
+        if not preamble:
+            return None
+        with open(os.path.join(build_dir, "compile_commands.json"), 'r') as f:
+            arguments = json.load(f)[0]["arguments"]
+        flags = pch_flags(arguments, source) + [arg[len("--extra-arg="):] for arg in extra_args if arg.startswith("--extra-arg=")]
+
+        digest = hashlib.sha256()
+        for part in (preamble, json.dumps(flags), self._tree_version(header_tree(arguments)), self.clang):
+            digest.update(hashlib.sha256(part.encode()).digest())
+        key = digest.hexdigest()
+        pch = os.path.join(self.root, f"{key}.pch")
+
+        with self.lock:
+            if key in self.failed:
+                return None
+            if os.path.exists(pch):
+                return pch
+            event = self.building.get(key)
+            owner = event is None
+            if owner:
+                event = self.building[key] = threading.Event()
+
+        if not owner:
+            event.wait()
+            return pch if os.path.exists(pch) else None
+
+        built = self._build(preamble, flags, pch)
+        with self.lock:
+            if not built:
+                # A preamble that does not build on its own (for example an
+                # unterminated #if) is analyzed without a PCH.
+                self.failed.add(key)
+            del self.building[key]
+        event.set()
+        return pch if built else None
+
+
+def run_clang_tidy(source, build_dir, fixes, extra_args, pch=None, checks=None):
+    cmd = ["clang-tidy", source, "-p", build_dir, *extra_args, f"-export-fixes={fixes}"]
+    if pch:
+        cmd[4:4] = ["--extra-arg=-include-pch", f"--extra-arg={pch}"]
+    if checks:
+        cmd.append(f"-checks={checks}")
+    out = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True, check=False)
+    return out.stdout
+
+
+def run_tiers(source, build_dir, fixes, extra_args, pch=None, gate=True):
+    # Tier one only parses the file and reports compiler diagnostics. A file
+    # with hard errors goes straight back to the model; the path-sensitive
+    # clang-analyzer checks (tier two) only run on files that compile.
+    if gate:
+        output = run_clang_tidy(source, build_dir, fixes, extra_args, pch, SYNTAX_CHECKS)
+        if ERROR.search(output):
+            return output, "syntax"
+    return run_clang_tidy(source, build_dir, fixes, extra_args, pch), "full"
+
+
+class AnalysisError(RuntimeError):
+    pass
+
+
+class Handler(socketserver.StreamRequestHandler):
+    def handle(self):
+        for line in self.rfile:
+            # A bad request or a failed run is reported back to the client
+            # instead of dropping the connection.
+            try:
+                request = json.loads(line)
+                pch = self.server.preambles.get(request["source"], request["build_dir"], request["extra_args"])
+                output, tier = run_tiers(request["source"], request["build_dir"], request["fixes"], request["extra_args"], pch,
+                                         request.get("gate", True))
+                response = {"output": output, "tier": tier, "preamble": pch is not None}
+            except Exception as exc:
+                response = {"error": f"{type(exc).__name__}: {exc}"}
+            self.wfile.write(json.dumps(response).encode() + b"\n")
+            self.wfile.flush()
+
+
+class AnalysisServer(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    daemon_threads = True
+
+    def __init__(self, path, preambles):
+        if os.path.exists(path):
+            os.remove(path)
+        self.preambles = preambles
+        super().__init__(path, Handler)
+
+
+class AnalysisClient:
+    def __init__(self, path=SOCKET_PATH):
+        self.path = path
+
+    def available(self):
+        if not os.path.exists(self.path):
+            return False
+        try:
+            with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+                sock.connect(self.path)
+            return True
+        except OSError:
+            return False
+
+    def diagnose(self, source, build_dir, fixes, extra_args, gate=True):
+        request = {"source": source, "build_dir": build_dir, "fixes": fixes, "extra_args": extra_args, "gate": gate}
+        with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+            sock.connect(self.path)
+            stream = sock.makefile('rwb')
+            stream.write(json.dumps(request).encode() + b"\n")
+            stream.flush()
+            line = stream.readline()
+            if not line:
+                raise AnalysisError(f"analysis server at {self.path} closed the connection")
+            response = json.loads(line)
+            if "error" in response:
+                raise AnalysisError(f"analysis server failed on {source}: {response['error']}")
+            return response["output"], response.get("tier", "full")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Long-lived clang-tidy server that keeps kernel-header preambles precompiled")
+    parser.add_argument("--socket", default=SOCKET_PATH)
+    parser.add_argument("--preamble-dir", default=PREAMBLE_DIR)
+    parser.add_argument("--clang", default="clang", help="clang binary matching the clang-tidy version, used to build PCHs")
+    args = parser.parse_args()
+
+    os.makedirs(os.path.dirname(os.path.abspath(args.socket)), exist_ok=True)
+    server = AnalysisServer(args.socket, PreambleCache(args.preamble_dir, args.clang))
+    print(f"Analysis server listening on {args.socket}")
+    try:
+        server.serve_forever()
+    finally:
+        os.remove(args.socket)
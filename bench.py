@@ -0,0 +1,144 @@
+import argparse
+import glob
+import json
+import os
+import shutil
+import sqlite3
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+from mock_llm import MockLLM, make_server
+
+
+# Runs the full evaluation loop (main.py) against an in-process mock LLM at
+# several concurrency levels and reports harness throughput, so regressions in
+# the harness itself show up without spending API quota.
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+INPUTS = ["Makefile", "compile_commands.json", ".clang-tidy"]
+
+
+def scratch_config(base, url, questions, level, iterations, cache, kbuild):
+    config = json.loads(json.dumps(base))
+    config.pop("model", None)
+    config["models"] = [config.get("models", [base.get("model")])[0]]
+    # Repeat the question list so the highest concurrency level has work.
+    config["questions"] = [base["questions"][n % len(base["questions"])] for n in range(questions)]
+    config["workers"] = level
+    config["llm"] = {**config.get("llm", {}), "base_url": url, "concurrency": level,
+                     "requests_per_minute": None, "tokens_per_minute": None, "hedge": False}
+    # Fixed iteration count, so every level does the same amount of work.
+    config["scheduler"] = {"iterations": iterations, "max_iterations": iterations, "patience": iterations}
+    config["budget"] = {}
+    # The mock serves the same few drivers over and over, so cached analysis
+    # results would hide the clang-tidy and kbuild cost being measured.
+    config["tidy_cache"] = cache
+    config["kbuild"] = kbuild and base.get("kbuild", True)
+    config["results"] = "results.db"
+    config["trace"] = "traces"
+    return config
+
+
+def run_level(base, url, level, args):
+    scratch = tempfile.mkdtemp(prefix=f"bench-{level}-")
+    try:
+        for name in INPUTS:
+            if os.path.exists(name):
+                shutil.copy(name, scratch)
+        config = scratch_config(base, url, args.questions, level, args.iterations, args.cache, not args.no_kbuild)
+        with open(os.path.join(scratch, "config.json"), 'w') as f:
+            json.dump(config, f)
+
+        start = time.monotonic()
+        result = subprocess.run([sys.executable, os.path.join(HERE, "main.py")], cwd=scratch,
+                                stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+        elapsed = time.monotonic() - start
+        if result.returncode != 0:
+            sys.exit(f"main.py failed at concurrency {level}:\n{result.stdout[-2000:]}")
+
+        db = sqlite3.connect(os.path.join(scratch, "results.db"))
+        units = db.execute("SELECT COUNT(*) FROM units").fetchone()[0]
+        summary = json.loads(db.execute("SELECT summary FROM runs").fetchone()[0])
+        db.close()
+        stages = summary.get("stages", {})
+        analyses = sum(stages.get(stage, {}).get("count", 0) for stage in ("clang-tidy", "kbuild"))
+        return {
+            "concurrency": level,
+            "questions": args.questions,
+            "units": units,
+            "elapsed": elapsed,
+            "questions_per_minute": units / elapsed * 60,
+            "analyses_per_second": analyses / elapsed,
+            "analysis_p95": max((stages.get(stage, {}).get("p95", 0.0) for stage in ("clang-tidy", "kbuild")), default=0.0),
+            "llm_p95": stages.get("llm", {}).get("p95", 0.0),
+        }
+    finally:
+        shutil.rmtree(scratch, ignore_errors=True)
+
+
+def print_table(rows):
+    header = f"{'conc':>5}{'units':>7}{'wall':>9}{'q/min':>9}{'analyses/s':>12}{'analysis p95':>14}{'llm p95':>9}{'speedup':>9}{'eff':>6}"
+    print(header)
+    print("-" * len(header))
+    base = rows[0]["questions_per_minute"] / rows[0]["concurrency"]
+    for row in rows:
+        speedup = row["questions_per_minute"] / base
+        print(f"{row['concurrency']:>5}{row['units']:>7}{row['elapsed']:>8.1f}s{row['questions_per_minute']:>9.1f}"
+              f"{row['analyses_per_second']:>12.2f}{row['analysis_p95']:>13.3f}s{row['llm_p95']:>8.2f}s"
+              f"{speedup:>8.1f}x{speedup / row['concurrency']:>6.0%}")
+
+
+def regressions(rows, baseline, tolerance):
+    previous = {row["concurrency"]: row for row in baseline}
+    for row in rows:
+        old = previous.get(row["concurrency"])
+        if old and row["questions_per_minute"] < old["questions_per_minute"] * (1 - tolerance):
+            yield row["concurrency"], old["questions_per_minute"], row["questions_per_minute"]
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Benchmark evaluation throughput against a mock LLM")
+    parser.add_argument("--levels", default="1,2,4,8,16,32,64", help="comma-separated concurrency levels")
+    parser.add_argument("--questions", type=int, default=64, help="questions per run (the config's list is repeated)")
+    parser.add_argument("--iterations", type=int, default=2)
+    parser.add_argument("--latency", type=float, default=2.0, help="median mock latency in seconds")
+    parser.add_argument("--jitter", type=float, default=0.5)
+    parser.add_argument("--distribution", choices=["normal", "lognormal", "exponential"], default="lognormal")
+    parser.add_argument("--tokens-per-second", type=float, default=0.0)
+    parser.add_argument("--seed", type=int, default=0)
+    parser.add_argument("--cache", action="store_true", help="keep the analysis cache on")
+    parser.add_argument("--no-kbuild", action="store_true", help="skip the kernel build stage")
+    parser.add_argument("--output", help="write the results as JSON")
+    parser.add_argument("--baseline", help="JSON from an earlier --output; exit 1 if questions/minute dropped")
+    parser.add_argument("--tolerance", type=float, default=0.10)
+    parser.add_argument("corpus", nargs="*", help="drivers served by the mock (default: temp_ldd/*.c and ldd.c)")
+    args = parser.parse_args()
+
+    corpus = args.corpus or sorted(glob.glob("temp_ldd/*.c")) + ["ldd.c"]
+    mock = MockLLM(corpus, args.latency, args.jitter, args.tokens_per_second, args.seed, distribution=args.distribution)
+    server = make_server(mock, port=0)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    url = f"http://127.0.0.1:{server.server_address[1]}"
+
+    with open("config.json", 'r') as f:
+        base = json.load(f)
+
+    rows = []
+    for level in (int(level) for level in args.levels.split(",")):
+        print(f"concurrency {level}...", file=sys.stderr)
+        rows.append(run_level(base, url, level, args))
+    server.shutdown()
+    print_table(rows)
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(rows, f, indent=2)
+    if args.baseline:
+        with open(args.baseline, 'r') as f:
+            slower = list(regressions(rows, json.load(f), args.tolerance))
+        for level, old, new in slower:
+            print(f"regression at concurrency {level}: {old:.1f} -> {new:.1f} questions/minute")
+        sys.exit(1 if slower else 0)
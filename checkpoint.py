@@ -0,0 +1,79 @@
+import json
+import os
+
+
+CHECKPOINT_DIR = ".cache/checkpoints"
+
+
+def write_atomic(path, data):
+    # Write to a temporary file, flush it to disk and rename it over the old
+    # checkpoint, so a crash leaves either the previous or the new version.
+    staging = f"{path}.{os.getpid()}.tmp"
+    with open(staging, 'w') as f:
+        json.dump(data, f)
+        f.flush()
+        os.fsync(f.fileno())
+    os.replace(staging, path)
+
+
+def latest_run(root=CHECKPOINT_DIR):
+    runs = [name for name in os.listdir(root) if os.path.isdir(os.path.join(root, name))] if os.path.isdir(root) else []
+    return max(runs, key=lambda name: os.path.getmtime(os.path.join(root, name)), default=None)
+
+
+class Checkpoint:
+    # One directory per model of a run. After every completed unit only that
+    # question's file (workspace state and the finished unit) is rewritten,
+    # and its prompt and response are appended to a journal; the scheduler
+    # and the score counters are rewritten once per round. The cost of a
+    # save therefore does not grow with the number of questions or rounds.
+    def __init__(self, run_id, model, root=CHECKPOINT_DIR):
+        self.dir = os.path.join(root, run_id, model.replace("/", "_"))
+        self.state = os.path.join(self.dir, "state.json")
+        self.history = os.path.join(self.dir, "history.jsonl")
+        os.makedirs(self.dir, exist_ok=True)
+
+    def _question(self, j):
+        return os.path.join(self.dir, f"q{j}.json")
+
+    def load(self):
+        if not os.path.exists(self.state):
+            return None
+        with open(self.state, 'r') as f:
+            state = json.load(f)
+        workspaces, pending = {}, {}
+        for name in os.listdir(self.dir):
+            if name.startswith("q") and name.endswith(".json"):
+                with open(os.path.join(self.dir, name), 'r') as f:
+                    question = json.load(f)
+                j = int(name[1:-len(".json")])
+                workspaces[j] = {**question["workspace"], "history": []}
+                if question.get("pending"):
+                    pending[j] = question["pending"]
+        # A unit rerun after a crash appends its entry again; the last one
+        # for each question and iteration is the one that was kept.
+        entries = {}
+        if os.path.exists(self.history):
+            with open(self.history, 'r') as f:
+                for line in f:
+                    try:
+                        entry = json.loads(line)
+                    except json.JSONDecodeError:
+                        break  # torn last line
+                    entries[(entry["question"], entry["iteration"])] = entry
+        for (j, _), entry in sorted(entries.items()):
+            if j in workspaces:
+                workspaces[j]["history"].append({key: entry[key] for key in ("iteration", "prompt", "response")})
+        return {**state, "workspaces": workspaces, "pending": pending}
+
+    def save_unit(self, j, snapshot, pending, history):
+        # The journal entry goes first: if the question file is not written,
+        # the unit is rerun and its new entry supersedes this one.
+        with open(self.history, 'a') as f:
+            f.write(json.dumps({"question": j, **history}) + "\n")
+            f.flush()
+            os.fsync(f.fileno())
+        write_atomic(self._question(j), {"workspace": snapshot, "pending": pending})
+
+    def save(self, state):
+        write_atomic(self.state, state)
@@ -0,0 +1,146 @@
+import argparse
+import hashlib
+import json
+import os
+import re
+import shlex
+import shutil
+import subprocess
+import tempfile
+
+import kbuild
+from tidy_cache import header_tree_version, tool_version
+
+
+CACHE_DIR = ".cache/compile_db"
+
+# gcc-only flags clang rejects or ignores; the same list the old jq filter
+# removed. Flags the local clang reports as unknown are dropped as well.
+GCC_ONLY = {
+    "-fconserve-stack",
+    "-fno-allow-store-data-races",
+    "-mindirect-branch-register",
+    "-mindirect-branch=thunk-extern",
+    "-mpreferred-stack-boundary=3",
+    "-fsanitize=bounds-strict",
+    "-mrecord-mcount",
+    "-falign-jumps=1",
+}
+PROBE = '#include <linux/module.h>\nMODULE_LICENSE("GPL");\n'
+CLANG_REJECTED = re.compile(r"clang\S*: (?:error|warning): (?:unknown argument|unsupported option|unsupported argument"
+                            r"|optimization flag|the clang compiler does not support)")
+QUOTED = re.compile(r"'([^']+)'")
+
+
+def record_command(kdir):
+    # Build a one-line module named ldd with kbuild and read the compiler
+    # command it saved in .ldd.o.cmd (savedcmd_ on newer kernels, cmd_ on
+    # older ones). That is the exact line `bear -- make` would capture.
+    probe = tempfile.mkdtemp(prefix="compile-db-")
+    try:
+        with open(os.path.join(probe, "ldd.c"), 'w') as f:
+            f.write(PROBE)
+        with open(os.path.join(probe, "Kbuild"), 'w') as f:
+            f.write("obj-m += ldd.o\n")
+        out = subprocess.run(["make", "-C", kdir, f"M={probe}", "ldd.o"],
+                             stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True, check=False)
+        cmd_file = os.path.join(probe, ".ldd.o.cmd")
+        if not os.path.exists(cmd_file):
+            raise RuntimeError(f"kbuild did not record a command for the probe module:\n{out.stdout[-2000:]}")
+        with open(cmd_file, 'r') as f:
+            line = next((line for line in f if re.match(r"^(?:saved)?cmd_\S*ldd\.o\s*:=", line)), None)
+        if line is None:
+            raise RuntimeError(f"no compiler command in {cmd_file}")
+        arguments = shlex.split(line.split(":=", 1)[1])
+        # Older kernels compile from the kernel tree with relative -I paths.
+        tree = os.path.realpath(kdir)
+        for n, arg in enumerate(arguments):
+            for prefix in ("-I", "-isystem", ""):
+                path = arg[len(prefix):]
+                if arg.startswith(prefix) and path and not path.startswith(("/", "-")) and os.path.exists(os.path.join(tree, path)):
+                    arguments[n] = prefix + os.path.normpath(os.path.join(tree, path))
+                    break
+        arguments = [arg.replace(probe + "/", "").replace(probe, ".") for arg in arguments]
+        return arguments
+    finally:
+        shutil.rmtree(probe, ignore_errors=True)
+
+
+def clang_filter(arguments, clang="clang"):
+    # Drop whatever the local clang rejects or ignores, asking it again until
+    # it accepts the rest (usually one round).
+    flags = [arg for arg in arguments if arg not in GCC_ONLY]
+    if shutil.which(clang) is None:
+        return flags
+    for _ in range(5):
+        options = [arg for arg in flags[1:] if arg not in ("-c", "-o", "ldd.o", "ldd.c") and not arg.startswith("-Wp,")]
+        # -### stops after the driver, which is where these are reported.
+        out = subprocess.run([clang, "-###", "-fsyntax-only", "-x", "c", "-", *options], input="",
+                             stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True, check=False)
+        rejected = set()
+        for line in out.stdout.splitlines():
+            if CLANG_REJECTED.search(line):
+                quoted = QUOTED.findall(line)
+                rejected.update(quoted)
+                # "unsupported argument 'X' to option 'Y'" names -YX.
+                if len(quoted) == 2 and "to option" in line:
+                    rejected.add(quoted[1] + quoted[0])
+        drop = [arg for arg in flags[1:] if arg in rejected]
+        if not drop:
+            break
+        flags = [flags[0]] + [arg for arg in flags[1:] if arg not in drop]
+    return flags
+
+
+def template(kdir=kbuild.KDIR, root=CACHE_DIR, clang="clang"):
+    # Cached per kernel tree, its generated headers and the clang version, so
+    # only the first run against a new tree pays for the probe build.
+    tree = os.path.realpath(kdir)
+    digest = hashlib.sha256("\n".join((tree, header_tree_version(tree), tool_version(clang))).encode()).hexdigest()
+    path = os.path.join(root, f"{digest}.json")
+    if os.path.exists(path):
+        with open(path, 'r') as f:
+            return json.load(f)
+    arguments = clang_filter(record_command(kdir), clang)
+    os.makedirs(root, exist_ok=True)
+    staging = f"{path}.{os.getpid()}.tmp"
+    with open(staging, 'w') as f:
+        json.dump(arguments, f, indent=2)
+    os.replace(staging, path)
+    return arguments
+
+
+def entry(arguments, source):
+    # The template was recorded for a module named ldd; rename it for this
+    # file the way kbuild would.
+    directory = os.path.dirname(os.path.abspath(source))
+    stem = os.path.splitext(os.path.basename(source))[0]
+    renamed = []
+    for arg in arguments:
+        arg = (arg.replace('"ldd"', f'"{stem}"').replace("kmod_ldd", f"kmod_{stem}")
+               .replace(".ldd.o.d", f".{stem}.o.d"))
+        renamed.append({"ldd.o": f"{stem}.o", "ldd.c": os.path.abspath(source)}.get(arg, arg))
+    return {
+        "arguments": renamed,
+        "directory": directory,
+        "file": os.path.abspath(source),
+        "output": os.path.join(directory, f"{stem}.o"),
+    }
+
+
+def write(sources, output, kdir=kbuild.KDIR, clang="clang"):
+    arguments = template(kdir, clang=clang)
+    with open(output, 'w') as f:
+        json.dump([entry(arguments, source) for source in sources], f, indent=2)
+    return output
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Write compile_commands.json for kernel drivers without bear or jq")
+    parser.add_argument("--kdir", default=kbuild.KDIR)
+    parser.add_argument("--clang", default="clang", help="clang whose unsupported flags are filtered out")
+    parser.add_argument("--output", default="compile_commands.json")
+    parser.add_argument("sources", nargs="*", default=["ldd.c"])
+    args = parser.parse_args()
+    write(args.sources, args.output, args.kdir, args.clang)
+    print(f"Wrote {len(args.sources)} entries to {args.output}")
@@ -0,0 +1,79 @@
+import json
+import os
+import subprocess
+import tempfile
+
+
+# Header dependencies of a driver, as gcc writes them to .<stem>.o.d during a
+# kbuild compile. kbuild's fixdep folds that file into .<stem>.o.cmd and
+# deletes it, and clang-tidy never writes it, so it is produced here with a
+# preprocessor-only run of the driver's own compile command. The run writes
+# to a private file: a kbuild of the same workspace may be running at the
+# same time and owns .<stem>.o.d.
+
+def parse(path):
+    # Make syntax: "target: dep dep \" with backslash-escaped spaces.
+    with open(path, 'r') as f:
+        text = f.read().replace("\\\n", " ")
+    rule = text.split(":", 1)[1] if ":" in text else ""
+    deps, word = [], ""
+    chars = iter(rule.split("\n", 1)[0])
+    for char in chars:
+        if char == "\\":
+            word += next(chars, "")
+        elif char.isspace():
+            if word:
+                deps.append(word)
+            word = ""
+        else:
+            word += char
+    if word:
+        deps.append(word)
+    return deps
+
+
+def command(compile_db, depfile):
+    with open(compile_db, 'r') as f:
+        entry = json.load(f)[0]
+    arguments, directory = entry["arguments"], entry["directory"]
+    cmd, skip = [arguments[0]], False
+    for arg in arguments[1:]:
+        if skip:
+            skip = False
+        elif arg == "-o":
+            skip = True
+        elif arg != "-c" and not arg.startswith("-Wp,-M"):
+            cmd.append(arg)
+    # -MG lists a missing header instead of failing, so a driver that includes
+    # a header added later is invalidated when it appears.
+    return cmd + ["-M", "-MG", "-MF", depfile], directory
+
+
+def scan(compile_db):
+    # Every file the driver's translation unit reads except the driver itself,
+    # as absolute paths, or None if the preprocessor failed.
+    handle, depfile = tempfile.mkstemp(prefix="depfile-", suffix=".d")
+    os.close(handle)
+    try:
+        cmd, directory = command(compile_db, depfile)
+        try:
+            out = subprocess.run(cmd, cwd=directory, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, check=False)
+        except FileNotFoundError:
+            return None
+        if out.returncode != 0:
+            return None
+        listed = parse(depfile)
+    finally:
+        os.remove(depfile)
+    with open(compile_db, 'r') as f:
+        source = os.path.abspath(json.load(f)[0]["file"])
+    includes = [directory] + [arg[2:] for arg in cmd if arg.startswith("-I") and len(arg) > 2]
+    deps = set()
+    for dep in listed:
+        if os.path.isabs(dep) or os.path.exists(os.path.join(directory, dep)):
+            deps.add(os.path.normpath(os.path.join(directory, dep)))
+        else:
+            # A missing header could appear in any include directory.
+            deps.update(os.path.normpath(os.path.join(directory, root, dep)) for root in includes)
+    deps.discard(source)
+    return sorted(deps)
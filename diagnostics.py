@@ -0,0 +1,154 @@
+import bisect
+import os
+import re
+from dataclasses import dataclass, field, replace
+
+import yaml
+
+
+# libyaml's C loader parses the exported fixes several times faster than the
+# pure-Python one; fall back when PyYAML was built without it.
+Loader = getattr(yaml, "CSafeLoader", yaml.SafeLoader)
+
+LINE = re.compile(
+    r"^(?P<file>[^\s:][^:]*):(?P<line>\d+):(?P<column>\d+):\s+"
+    r"(?P<level>fatal error|error|warning|note):\s+(?P<message>.*?)"
+    r"(?:\s+\[(?P<check>[^\]\s]+)\])?$"
+)
+MODPOST = re.compile(r"^(?P<level>ERROR|WARNING): modpost: (?P<message>.*)$")
+
+
+@dataclass
+class Note:
+    file: str
+    line: int
+    column: int
+    message: str
+
+
+@dataclass
+class Diagnostic:
+    check: str
+    level: str
+    file: str
+    line: int
+    column: int
+    message: str
+    notes: list = field(default_factory=list)
+    replacements: list = field(default_factory=list)
+
+    def key(self):
+        return (os.path.basename(self.file), self.line, self.column, self.level, self.check, self.message)
+
+    def format(self):
+        check = f" [{self.check}]" if self.check else ""
+        return f"{self.file}:{self.line}:{self.column}: {self.level}: {self.message}{check}"
+
+
+def parse(lines):
+    # Streaming parser for clang-tidy, clang and gcc output. Notes such as
+    # "expanded from macro 'memset'" always attach to the diagnostic before
+    # them; source excerpts, carets and summary lines are skipped.
+    current = None
+    for line in lines:
+        line = line.rstrip("\n")
+        match = LINE.match(line)
+        if match:
+            level = match["level"]
+            if level == "note":
+                if current is not None:
+                    current.notes.append(Note(match["file"], int(match["line"]), int(match["column"]), match["message"]))
+                continue
+            if current is not None:
+                yield current
+            current = Diagnostic(
+                match["check"] or "",
+                "error" if level == "fatal error" else level,
+                match["file"],
+                int(match["line"]),
+                int(match["column"]),
+                match["message"],
+            )
+            continue
+        match = MODPOST.match(line)
+        if match:
+            if current is not None:
+                yield current
+            current = None
+            yield Diagnostic("modpost", match["level"].lower(), "", 0, 0, match["message"])
+    if current is not None:
+        yield current
+
+
+def from_dict(data):
+    # Inverse of dataclasses.asdict, for diagnostics kept in checkpoints.
+    return Diagnostic(**{**data, "notes": [Note(**note) for note in data.get("notes", [])]})
+
+
+def relocate(records, old, new):
+    # Copies of `records` with paths under directory `old` moved to `new`.
+    def move(path):
+        return new + path[len(old):] if path == old or path.startswith(old + os.sep) else path
+    return [replace(r, file=move(r.file), notes=[replace(n, file=move(n.file)) for n in r.notes]) for r in records]
+
+
+def dedupe(records):
+    unique = {}
+    for record in records:
+        unique.setdefault(record.key(), record)
+    return list(unique.values())
+
+
+def load_fixes(path):
+    if not os.path.exists(path):
+        return {}
+    with open(path, 'r') as f:
+        return yaml.load(f, Loader=Loader) or {}
+
+
+def attach_replacements(records, exported, source):
+    # The exported YAML locates diagnostics by byte offset; map those to
+    # line:column once so replacements join the records parsed from stdout.
+    starts = [0]
+    for n, char in enumerate(source.encode()):
+        if char == 0x0A:
+            starts.append(n + 1)
+    by_position = {}
+    for record in records:
+        by_position.setdefault((record.check, record.line, record.column), record)
+
+    for entry in exported.get("Diagnostics") or []:
+        message = entry.get("DiagnosticMessage") or {}
+        replacements = message.get("Replacements") or []
+        if not replacements:
+            continue
+        offset = message.get("FileOffset", 0)
+        line = bisect.bisect_right(starts, offset)
+        column = offset - starts[line - 1] + 1
+        record = by_position.get((entry.get("DiagnosticName", ""), line, column))
+        if record is not None:
+            record.replacements = [
+                {"offset": r.get("Offset"), "length": r.get("Length"), "text": r.get("ReplacementText", "")}
+                for r in replacements
+            ]
+    return records
+
+
+def merge(primary, secondary):
+    # Keep secondary (compiler) diagnostics only where the primary stream
+    # (clang-tidy) has nothing of the same level on that line.
+    seen = {(os.path.basename(r.file), r.line, r.level) for r in primary if r.line}
+    merged = list(primary)
+    for record in secondary:
+        position = (os.path.basename(record.file), record.line, record.level)
+        if record.line and position in seen:
+            continue
+        seen.add(position)
+        merged.append(record)
+    return merged
+
+
+def count(records):
+    warnings = sum(1 for r in records if r.level == "warning")
+    errors = sum(1 for r in records if r.level == "error")
+    return warnings, errors
@@ -0,0 +1,54 @@
+import os
+
+from llm import estimate_tokens
+
+
+def _context(lines, line, radius):
+    start = max(1, line - radius)
+    end = min(len(lines), line + radius)
+    return [f"{n:>5} | {lines[n - 1]}" for n in range(start, end + 1)]
+
+
+def _in_driver(record, path):
+    if not os.path.isabs(record.file):
+        return os.path.basename(record.file) == os.path.basename(path)
+    return os.path.realpath(record.file) == os.path.realpath(path)
+
+
+def _location(record, path):
+    name = os.path.basename(path) if _in_driver(record, path) else record.file
+    return f"{name}:{record.line}:{record.column}"
+
+
+def build_digest(records, source, path, context_lines=2, token_cap=2000):
+    # Compact replacement for the raw fixes YAML: one entry per distinct
+    # (level, check, message), listing every file:line:col it occurs at, with
+    # the driver source around its first occurrence in the driver (`path`).
+    # Errors come first; once the token cap is reached the rest is
+    # summarized in a single line.
+    lines = source.split("\n")
+    groups = {}
+    for record in records:
+        groups.setdefault((record.level, record.check, record.message), []).append(record)
+    ordered = sorted(groups.items(), key=lambda item: (item[0][0] != "error", item[1][0].line))
+
+    out = []
+    used = 0
+    for n, ((level, check, message), group) in enumerate(ordered):
+        locations = ", ".join(_location(r, path) for r in group if r.line) or "link"
+        entry = [f"- {locations} {level} [{check}] {message}" if check else f"- {locations} {level} {message}"]
+        notes = {note.message for r in group for note in r.notes}
+        entry += [f"  note: {note}" for note in sorted(notes)]
+        # Headers and other files get no context: driver lines next to them
+        # would only mislead.
+        first = next((r for r in group if r.line and _in_driver(r, path)), None)
+        if first and context_lines:
+            entry += _context(lines, first.line, context_lines)
+        cost = estimate_tokens("\n".join(entry))
+        if out and used + cost > token_cap:
+            omitted = sum(len(g) for _, g in ordered[n:])
+            out.append(f"- ... {omitted} more diagnostics omitted")
+            break
+        out.append("\n".join(entry))
+        used += cost
+    return "\n".join(out)
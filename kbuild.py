@@ -0,0 +1,252 @@
+import os
+import re
+import shutil
+import subprocess
+import tempfile
+import threading
+import time
+from concurrent.futures import Future
+
+
+KDIR = f"/lib/modules/{os.uname().release}/build"
+
+# Passed to kbuild as CC in batch mode: runs the real compiler and logs how
+# long each object took.
+CC_WRAPPER = """#!/bin/sh
+out=
+prev=
+for arg; do
+    [ "$prev" = "-o" ] && out=$arg
+    prev=$arg
+done
+start=$(date +%s%N)
+"$KBUILD_BATCH_CC" "$@"
+status=$?
+[ -n "$out" ] && echo "$out $start $(date +%s%N) $status" >> "$KBUILD_BATCH_TIMES"
+exit $status
+"""
+
+
+def available(kdir=KDIR):
+    return os.path.isdir(kdir)
+
+
+def release(kdir=KDIR):
+    # The kernel release the tree was configured for, e.g. 6.14.0-28-generic.
+    path = os.path.join(kdir, "include", "config", "kernel.release")
+    if os.path.exists(path):
+        with open(path, 'r') as f:
+            return f.read().strip()
+    return os.path.basename(os.path.realpath(kdir)).replace("linux-headers-", "")
+
+
+def build_module(ws, kdir=KDIR):
+    # Same as the Makefile's `all` target, but with M= pointing at the
+    # workspace so several drivers can be built side by side.
+    start = time.monotonic()
+    cmd = ["make", "-C", kdir, f"M={ws.dir}", "modules"]
+    out = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True, check=False)
+    seconds = time.monotonic() - start
+    with open(ws.build_log, 'w') as f:
+        f.write(out.stdout)
+    return out.stdout, out.returncode == 0, seconds
+
+
+def _make(batch, names, kdir, cc, times, jobs):
+    with open(os.path.join(batch, "Kbuild"), 'w') as f:
+        f.writelines(f"obj-m += {name}.o\n" for name in names)
+    # -k keeps going past a driver that does not compile.
+    cmd = ["make", "-C", kdir, f"M={batch}", "-k", f"-j{jobs or os.cpu_count()}", "modules"]
+    env = dict(os.environ)
+    if cc:
+        cmd.append(f"CC={os.path.join(batch, 'cc-wrapper')}")
+        env.update(KBUILD_BATCH_CC=cc, KBUILD_BATCH_TIMES=times)
+    out = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True, check=False, env=env)
+    return out.stdout
+
+
+def _object_seconds(times):
+    seconds = {}
+    if os.path.exists(times):
+        with open(times, 'r') as f:
+            for line in f:
+                parts = line.split()
+                if len(parts) == 4 and parts[0].endswith(".o"):
+                    name = os.path.basename(parts[0])[:-len(".o")]
+                    seconds[name] = (int(parts[2]) - int(parts[1])) / 1e9
+    return seconds
+
+
+# Output of a batch pass is split into blocks: a diagnostic with its include
+# chain, "In function" line, source excerpt and notes, or a single line of
+# kbuild or modpost output. A block belongs to the objects it names.
+OWNER = re.compile(r"(?<![\w.-])(?:[^\s:'\"\[\]]*/)?(?P<name>m\d+)\.(?:c|o|ko|mod)\b")
+# modpost also names a module by its path without an extension.
+MODPOST_OWNER = re.compile(r"(?<![\w.-])(?:[^\s:'\"\[\]]*/)?(?P<name>m\d+)(?:\.(?:o|ko|mod))?(?![\w.-])")
+CONTINUATION = re.compile(r"^(?:\s+(?:\d+\s*)?\||\s+from |[^\s:][^:]*:\d+:\d+: note: )")
+PREFIX = re.compile(r"^(?:In file included from |\s+from |\S.*: (?:In|At) )")
+DIAGNOSTIC = re.compile(r"^(?P<file>[^\s:][^:]*):\d+:\d+: ")
+
+
+def _owned(text, names, compiler_only=False):
+    # Lines of `text` per object name. A diagnostic in a header is found
+    # through its "In file included from .../mN.c" chain. gcc prints that
+    # chain only when it changes, so a block without one belongs to whoever
+    # owned the last diagnostic in the same file.
+    blocks, joined = [], False
+    for line in text.splitlines():
+        if blocks and (joined or CONTINUATION.match(line)):
+            blocks[-1].append(line)
+        else:
+            blocks.append([line])
+        joined = bool(PREFIX.match(line))
+    owned = {name: [] for name in names}
+    last = {}
+    for block in blocks:
+        pattern = MODPOST_OWNER if "modpost:" in block[0] else OWNER
+        found = {match["name"] for line in block for match in pattern.finditer(line)} & owned.keys()
+        diagnostic = next((match for match in map(DIAGNOSTIC.match, block) if match), None)
+        if diagnostic:
+            if found:
+                last[diagnostic["file"]] = found
+            else:
+                found = last.get(diagnostic["file"], set())
+        elif compiler_only:
+            continue
+        for name in found:
+            owned[name].extend(block)
+    return owned
+
+
+def _link(batch, names, kdir, cc, times, jobs, passes):
+    # modpost and the final link cover every object of a pass, so one driver
+    # with an undefined or unexported symbol fails all of them. Link the
+    # compiled objects again (they are up to date) and split the set in
+    # halves until each driver's result depends only on its own symbols.
+    # `passes` keeps the log of the last pass each driver took part in.
+    if not names:
+        return
+    text = _make(batch, names, kdir, cc, times, jobs)
+    for name in names:
+        passes[name] = text
+    failed = [name for name in names if not os.path.exists(os.path.join(batch, f"{name}.ko"))]
+    if not failed or len(names) == 1:
+        return
+    if len(failed) < len(names):
+        _link(batch, failed, kdir, cc, times, jobs, passes)
+    else:
+        _link(batch, failed[:len(failed) // 2], kdir, cc, times, jobs, passes)
+        _link(batch, failed[len(failed) // 2:], kdir, cc, times, jobs, passes)
+
+
+def build_batch(workspaces, root, kdir=KDIR, cc=None, jobs=None):
+    # One kbuild pass for many drivers: each workspace's source becomes its
+    # own obj-m object m<N>.o in a scratch directory, so the fixed cost of
+    # kbuild (Makefile parsing, scripts, modpost) is paid once per batch.
+    # Diagnostics, success and compile time are mapped back per object.
+    os.makedirs(root, exist_ok=True)
+    batch = tempfile.mkdtemp(prefix="batch-", dir=root)
+    try:
+        names = [f"m{n}" for n in range(len(workspaces))]
+        for name, ws in zip(names, workspaces):
+            shutil.copyfile(ws.source, os.path.join(batch, f"{name}.c"))
+        wrapper = os.path.join(batch, "cc-wrapper")
+        with open(wrapper, 'w') as f:
+            f.write(CC_WRAPPER)
+        os.chmod(wrapper, 0o755)
+        times = os.path.join(batch, "times.log")
+
+        start = time.monotonic()
+        text = _make(batch, names, kdir, cc, times, jobs)
+        passes = {name: text for name in names}
+        # modpost only runs once every object compiled, and fails for all of
+        # them if one has a bad symbol; relink whatever compiled but has no
+        # module yet.
+        unlinked = [name for name in names if os.path.exists(os.path.join(batch, f"{name}.o"))
+                    and not os.path.exists(os.path.join(batch, f"{name}.ko"))]
+        _link(batch, unlinked, kdir, cc, times, jobs, passes)
+        elapsed = time.monotonic() - start
+        seconds = _object_seconds(times)
+
+        results = []
+        first = _owned(text, names)
+        compiled = _owned(text, names, compiler_only=True)
+        for name, ws in zip(names, workspaces):
+            path = re.compile(rf"(?<![\w.-])(?:[^\s:'\"\[\]]*/)?{name}\.c\b")
+            lines = first[name]
+            if passes[name] is not text:
+                # Compiler diagnostics come from the first pass, link errors
+                # from the last pass the driver took part in.
+                lines = compiled[name] + _owned(passes[name], [name])[name]
+            lines = [path.sub(ws.source, line) for line in lines]
+            built = os.path.exists(os.path.join(batch, f"{name}.ko"))
+            if not built and not lines:
+                # Nothing points at this driver (e.g. kbuild itself failed);
+                # keep the log of its last pass so the failure is not silent.
+                lines = passes[name].splitlines()
+            output = "\n".join(lines) + "\n" if lines else ""
+            with open(ws.build_log, 'w') as f:
+                f.write(output)
+            results.append((output, built, seconds.get(name, elapsed / len(names))))
+        return results
+    finally:
+        shutil.rmtree(batch, ignore_errors=True)
+
+
+class BatchBuilder:
+    # Collects build requests from the analysis threads and compiles them
+    # together once no new request has arrived for `window` seconds, or as
+    # soon as `max_batch` are waiting. build() blocks until its batch is done.
+    def __init__(self, root, kdir=KDIR, cc=None, window=0.5, max_batch=64, jobs=None):
+        self.root = root
+        self.kdir = kdir
+        self.cc = cc
+        self.window = window
+        self.max_batch = max_batch
+        self.jobs = jobs
+        self.lock = threading.Lock()
+        self.pending = []
+        self.timer = None
+        self.batches = 0
+        self.objects = 0
+
+    def build(self, ws):
+        future = Future()
+        batch = None
+        with self.lock:
+            self.pending.append((ws, future))
+            if self.timer:
+                self.timer.cancel()
+                self.timer = None
+            if len(self.pending) >= self.max_batch:
+                batch = self._take()
+            else:
+                self.timer = threading.Timer(self.window, self._flush)
+                self.timer.daemon = True
+                self.timer.start()
+        if batch:
+            self._run(batch)
+        return future.result()
+
+    def _take(self):
+        batch, self.pending = self.pending, []
+        self.batches += 1
+        self.objects += len(batch)
+        return batch
+
+    def _flush(self):
+        with self.lock:
+            batch = self._take() if self.pending else None
+            self.timer = None
+        if batch:
+            self._run(batch)
+
+    def _run(self, batch):
+        try:
+            results = build_batch([ws for ws, _ in batch], self.root, self.kdir, self.cc, self.jobs)
+        except Exception as exc:
+            for _, future in batch:
+                future.set_exception(exc)
+            return
+        for (_, future), result in zip(batch, results):
+            future.set_result(result)
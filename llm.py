@@ -0,0 +1,189 @@
+import asyncio
+import random
+import time
+from collections import deque, namedtuple
+
+from google import genai
+from google.genai import types
+
+
+Completion = namedtuple("Completion", ["text", "prompt_tokens", "output_tokens", "latency"])
+
+
+def estimate_tokens(text):
+    # ~4 characters per token is close enough for rate limiting; the real
+    # counts from usage_metadata are settled after each call.
+    return max(1, len(text) // 4)
+
+
+class TokenBucket:
+    def __init__(self, per_minute):
+        self.capacity = float(per_minute)
+        self.tokens = float(per_minute)
+        self.rate = per_minute / 60.0
+        self.updated = time.monotonic()
+        self.lock = asyncio.Lock()
+
+    def _refill(self):
+        now = time.monotonic()
+        self.tokens = min(self.capacity, self.tokens + (now - self.updated) * self.rate)
+        self.updated = now
+
+    async def acquire(self, amount):
+        amount = min(amount, self.capacity)
+        async with self.lock:
+            while True:
+                self._refill()
+                if self.tokens >= amount:
+                    self.tokens -= amount
+                    return
+                await asyncio.sleep((amount - self.tokens) / self.rate)
+
+    def charge(self, amount):
+        # Settle the difference between the estimate and the real usage.
+        # The balance may go negative, which simply delays later callers.
+        self._refill()
+        self.tokens -= amount
+
+
+def retriable(exc):
+    # Rate limits, server errors, timeouts and dropped connections are worth
+    # another try; other client errors (bad key, bad request) are not.
+    code = getattr(exc, "code", None)
+    if isinstance(code, int):
+        return code == 429 or code >= 500
+    # Other OSErrors (a missing file, a permission error) would fail again.
+    return isinstance(exc, (asyncio.TimeoutError, TimeoutError, ConnectionError)) or type(exc).__module__.startswith(("httpx", "httpcore"))
+
+
+def percentile(values, q):
+    if not values:
+        return 0.0
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(q * len(ordered)))]
+
+
+class AsyncLLM:
+    def __init__(self, api_key, model, concurrency=8, requests_per_minute=None, tokens_per_minute=None, base_url=None,
+                 timeout_seconds=None, max_retries=0, backoff_seconds=1.0, backoff_max_seconds=30.0,
+                 hedge=False, hedge_min_samples=20):
+        http_options = types.HttpOptions(base_url=base_url) if base_url else None
+        self.client = genai.Client(api_key=api_key or "mock", http_options=http_options)
+        self.model = model
+        self.slots = asyncio.Semaphore(concurrency)
+        self.request_bucket = TokenBucket(requests_per_minute) if requests_per_minute else None
+        self.token_bucket = TokenBucket(tokens_per_minute) if tokens_per_minute else None
+        self.timeout = timeout_seconds
+        self.max_retries = max_retries
+        self.backoff = backoff_seconds
+        self.backoff_max = backoff_max_seconds
+        self.hedge = hedge
+        self.hedge_min_samples = hedge_min_samples
+        self.samples = deque(maxlen=500)
+        self.latencies = []
+        self.retries = 0
+        self.hedges = 0
+        self.hedge_wins = 0
+
+    @classmethod
+    def from_config(cls, api_key, model, config):
+        return cls(
+            api_key,
+            model,
+            concurrency=config.get("concurrency", 8),
+            requests_per_minute=config.get("requests_per_minute"),
+            tokens_per_minute=config.get("tokens_per_minute"),
+            base_url=config.get("base_url"),
+            timeout_seconds=config.get("timeout_seconds"),
+            max_retries=config.get("max_retries", 0),
+            backoff_seconds=config.get("backoff_seconds", 1.0),
+            backoff_max_seconds=config.get("backoff_max_seconds", 30.0),
+            hedge=config.get("hedge", False),
+            hedge_min_samples=config.get("hedge_min_samples", 20),
+        )
+
+    async def _call(self, prompt, estimate, sent=None):
+        if self.request_bucket:
+            await self.request_bucket.acquire(1)
+        if self.token_bucket:
+            await self.token_bucket.acquire(estimate)
+
+        async with self.slots:
+            if sent:
+                sent.set()
+            start = time.monotonic()
+            request = self.client.aio.models.generate_content(model=self.model, contents=prompt)
+            response = await asyncio.wait_for(request, self.timeout) if self.timeout else await request
+            self.samples.append(time.monotonic() - start)
+        return response
+
+    async def _hedged(self, prompt, estimate):
+        # Once enough calls have been observed, a call still running after
+        # the observed p95 gets a duplicate; whichever answers first wins.
+        if not self.hedge or len(self.samples) < self.hedge_min_samples:
+            return await self._call(prompt, estimate)
+        # The timer starts once the request is sent: time spent waiting for
+        # the rate limit or a concurrency slot must not trigger a hedge, or a
+        # saturated client would double its own load.
+        sent = asyncio.Event()
+        primary = asyncio.create_task(self._call(prompt, estimate, sent))
+        waiter = asyncio.create_task(sent.wait())
+        await asyncio.wait({primary, waiter}, return_when=asyncio.FIRST_COMPLETED)
+        waiter.cancel()
+        if not primary.done():
+            await asyncio.wait({primary}, timeout=percentile(self.samples, 0.95))
+        if primary.done():
+            return primary.result()
+
+        self.hedges += 1
+        backup = asyncio.create_task(self._call(prompt, estimate))
+        pending = {primary, backup}
+        error = None
+        try:
+            while pending:
+                done, pending = await asyncio.wait(pending, return_when=asyncio.FIRST_COMPLETED)
+                for task in done:
+                    if task.exception() is None:
+                        self.hedge_wins += task is backup
+                        return task.result()
+                    error = task.exception()
+            raise error
+        finally:
+            for task in pending:
+                task.cancel()
+
+    async def generate(self, prompt, variant=0):
+        # `variant` only tells best-of-N candidates apart in the record/replay
+        # store; the API call itself is the same.
+        estimate = estimate_tokens(prompt)
+        start = time.monotonic()
+        for attempt in range(self.max_retries + 1):
+            try:
+                response = await self._hedged(prompt, estimate)
+                break
+            except Exception as exc:
+                if attempt == self.max_retries or not retriable(exc):
+                    raise
+                self.retries += 1
+                # Full jitter keeps retrying workers from synchronizing.
+                await asyncio.sleep(random.uniform(0, min(self.backoff_max, self.backoff * 2 ** attempt)))
+        latency = time.monotonic() - start
+        self.latencies.append(latency)
+
+        usage = response.usage_metadata
+        prompt_tokens = (usage and usage.prompt_token_count) or estimate
+        output_tokens = (usage and usage.candidates_token_count) or estimate_tokens(response.text or "")
+        if self.token_bucket:
+            self.token_bucket.charge(prompt_tokens + output_tokens - estimate)
+
+        return Completion(response.text or "", prompt_tokens, output_tokens, latency)
+
+    def latency_summary(self):
+        return {
+            "p50": percentile(self.latencies, 0.50),
+            "p95": percentile(self.latencies, 0.95),
+            "p99": percentile(self.latencies, 0.99),
+            "retries": self.retries,
+            "hedges": self.hedges,
+            "hedge_wins": self.hedge_wins,
+        }
@@ -0,0 +1,109 @@
+import asyncio
+import hashlib
+import os
+import sqlite3
+import time
+
+from llm import Completion
+
+
+class MissingPromptError(KeyError):
+    def __init__(self, model, prompt, key, variant=0):
+        self.model = model
+        self.prompt = prompt
+        self.key = key
+        self.variant = variant
+        preview = prompt[:200].replace("\n", " ")
+        super().__init__(f"No recorded response for model {model} variant {variant} (key {key[:12]}): {preview!r}")
+
+
+class RecordedCancellation(Exception):
+    # The call was cancelled while recording (a losing best-of-N candidate),
+    # so there is no response to replay.
+    def __init__(self, model, variant):
+        self.model = model
+        self.variant = variant
+        super().__init__(f"Call for model {model} variant {variant} was cancelled when recorded")
+
+
+class ResponseStore:
+    # Indexed prompt -> response store backed by SQLite, used to record a run
+    # and replay it later without calling the LLM.
+    def __init__(self, path):
+        self.db = sqlite3.connect(path)
+        self.db.execute(
+            "CREATE TABLE IF NOT EXISTS responses ("
+            "key TEXT PRIMARY KEY, model TEXT, prompt TEXT, text TEXT,"
+            "prompt_tokens INTEGER, output_tokens INTEGER, latency REAL, recorded_at REAL,"
+            "cancelled INTEGER DEFAULT 0)"
+        )
+        columns = {row[1] for row in self.db.execute("PRAGMA table_info(responses)")}
+        if "cancelled" not in columns:
+            self.db.execute("ALTER TABLE responses ADD COLUMN cancelled INTEGER DEFAULT 0")
+        self.db.commit()
+
+    @staticmethod
+    def key(model, prompt, variant=0):
+        # Prompts embed absolute workspace paths through the fixes YAML, so
+        # the working directory is stripped to keep a store portable.
+        prompt = prompt.replace(os.getcwd() + os.sep, "")
+        if variant:
+            prompt += f"\0{variant}"
+        return hashlib.sha256(f"{model}\0{prompt}".encode()).hexdigest()
+
+    def get(self, model, prompt, variant=0):
+        # A Completion, True if the call was cancelled when recorded, or None.
+        row = self.db.execute(
+            "SELECT text, prompt_tokens, output_tokens, latency, cancelled FROM responses WHERE key=?",
+            (self.key(model, prompt, variant),),
+        ).fetchone()
+        if row is None:
+            return None
+        return True if row[4] else Completion(*row[:4])
+
+    def put(self, model, prompt, completion, variant=0):
+        self.db.execute(
+            "INSERT OR REPLACE INTO responses VALUES (?,?,?,?,?,?,?,?,0)",
+            (self.key(model, prompt, variant), model, prompt, completion.text, completion.prompt_tokens,
+             completion.output_tokens, completion.latency, time.time()),
+        )
+        self.db.commit()
+
+    def put_cancelled(self, model, prompt, variant=0):
+        # Never replaces a recorded response for the same prompt.
+        self.db.execute(
+            "INSERT OR IGNORE INTO responses VALUES (?,?,?,NULL,0,0,0,?,1)",
+            (self.key(model, prompt, variant), model, prompt, time.time()),
+        )
+        self.db.commit()
+
+
+class RecordingLLM:
+    def __init__(self, llm, store):
+        self.llm = llm
+        self.model = llm.model
+        self.store = store
+
+    async def generate(self, prompt, variant=0):
+        try:
+            completion = await self.llm.generate(prompt, variant)
+        except asyncio.CancelledError:
+            self.store.put_cancelled(self.model, prompt, variant)
+            raise
+        self.store.put(self.model, prompt, completion, variant)
+        return completion
+
+
+class ReplayLLM:
+    def __init__(self, store, model):
+        self.store = store
+        self.model = model
+
+    async def generate(self, prompt, variant=0):
+        completion = self.store.get(self.model, prompt, variant)
+        if completion is None:
+            raise MissingPromptError(self.model, prompt, self.store.key(self.model, prompt, variant), variant)
+        if completion is True:
+            raise RecordedCancellation(self.model, variant)
+        # Replay runs at disk speed; the recorded latency stays in the store.
+        return completion._replace(latency=0.0)
@@ -1,143 +1,729 @@
-import requests
 import json
-from google import genai
+import argparse
+import asyncio
 import os
-import subprocess,re,yaml
+import statistics
+import time
+from collections import namedtuple
+from concurrent.futures import ThreadPoolExecutor
 from tqdm import tqdm
 
+import compile_db
+import diagnostics
+import kbuild
+from analysis_server import AnalysisClient, run_tiers
+from checkpoint import Checkpoint, latest_run
+from digest import build_digest
+from llm import AsyncLLM, Completion, estimate_tokens, percentile
+from patching import EDIT_INSTRUCTIONS, PatchError, apply_response
+from llm_store import RecordedCancellation, RecordingLLM, ReplayLLM, ResponseStore
+from results import ResultsStore, new_run_id
+from scheduler import Budget, Scheduler
+from staging import ARTIFACTS, STAGING_ROOT, check_path, stage, sync_back
+from tidy_cache import TidyCache, normalize_source
+from tracing import Tracer, print_summary, tag
+from workspace import Workspace
+from work_queue import WorkQueue, spawn
+
 
 from dotenv import load_dotenv ,find_dotenv
 load_dotenv(find_dotenv())
 
-iterations=5
-errors=[]
-warnings=[]
+parser=argparse.ArgumentParser(description="Evaluate an LLM on Linux device driver generation")
+mode=parser.add_mutually_exclusive_group()
+mode.add_argument("--record",metavar="STORE",help="record every prompt and response into this SQLite store")
+mode.add_argument("--replay",metavar="STORE",help="replay responses from this store instead of calling the LLM")
+parser.add_argument("--resume",metavar="RUN_ID",nargs="?",const="latest",help="continue an interrupted run from its checkpoints (default: the latest run)")
+args=parser.parse_args()
 
 api_key=os.getenv("google_ai_api_key")
 
 with open("config.json",'r') as f:
     data=json.load(f)
-    
+
+origin=os.getcwd()
+staging_config=data.get('staging') or {}
+staged_dbs=[data.get('results','results.db')]
+trace_dir=data.get('trace','traces')
+staged_artifacts=ARTIFACTS+([trace_dir] if trace_dir else [])
+if staging_config.get('enabled'):
+    # Run everything in tmpfs instead of the (slow) shared folder; paths
+    # given on the command line still refer to the original directory.
+    for name in ("record","replay"):
+        if getattr(args,name):
+            setattr(args,name,os.path.abspath(getattr(args,name)))
+    try:
+        check_path("results",staged_dbs[0])
+        if trace_dir:
+            check_path("trace",trace_dir)
+        if (data.get('queue') or {}).get('enabled'):
+            check_path("queue.path",data['queue'].get('path','.cache/queue.db'))
+        os.chdir(stage(origin,staging_config.get('root',STAGING_ROOT),staged_dbs))
+    except (ValueError,RuntimeError) as e:
+        parser.error(str(e))
+
 # print(api_key)
-    
-    
+
+
 
 questions=data['questions']
 style=data['coding-style']
-model=data['model']
-client=genai.Client(api_key=api_key)
+models=data.get('models') or [data['model']]
+workers=data.get('workers') or os.cpu_count()
+llm_config=data.get('llm',{})
+scheduler_config=data.get('scheduler',{})
+budget_config=data.get('budget',{})
+digest_config=data.get('digest',{})
+refine_mode=data.get('refine_mode','full')
+candidates=data.get('candidates',1)
 
-total_warning=0
+tidy_cache=TidyCache() if data.get('tidy_cache',True) else None
+analysis_server=AnalysisClient(data.get('analysis_server','.cache/analysis.sock'))
+analysis_server=analysis_server if analysis_server.available() else None
+kdir=data.get('kdir',kbuild.KDIR)
+extra_args=[f"--extra-arg=-I{os.path.join(kdir,'include')}"]
+compile_stage=data.get('kbuild',True) and kbuild.available(kdir)
+compile_template="compile_commands.json"
+if data.get('compile_db','native')=="native" and kbuild.available(kdir):
+    # Generated from kbuild's own command line and cached per kernel tree,
+    # instead of the checked-in `bear -- make` output.
+    try:
+        compile_template=compile_db.write(["ldd.c"],os.path.join(compile_db.CACHE_DIR,"compile_commands.json"),kdir)
+    except (RuntimeError,OSError) as e:
+        print(f"Warning: could not generate a compile database from {kdir}, using compile_commands.json: {e}")
+syntax_gate=data.get('syntax_gate',False)
+queue_config=data.get('queue') or {}
+# Checkpoints stay in the original directory even when staging, so they
+# survive the VM going down.
+checkpoint_dir=os.path.join(origin,data.get('checkpoints','.cache/checkpoints'))
+batch_config=data.get('kbuild_batch') or {}
+batcher=None
+if compile_stage and batch_config.get('enabled'):
+    with open(compile_template,'r') as f:
+        # The compiler the kernel headers were configured with, wrapped by
+        # kbuild.py to time each object.
+        kernel_cc=json.load(f)[0]["arguments"][0]
+    batcher=kbuild.BatchBuilder(os.path.abspath(os.path.join("work","batch")),kdir,kernel_cc,
+                                batch_config.get('window_seconds',0.5),batch_config.get('max_batch',64),batch_config.get('jobs'))
+# Extra kernel header trees every final driver is built against, e.g. the
+# 6.8 and 6.14 headers, to score portability across kernel versions.
+matrix=[]
+for tree in data.get('kernel_matrix') or []:
+    if not kbuild.available(tree):
+        print(f"Skipping kernel tree {tree}: not found")
+        continue
+    release=kbuild.release(tree)
+    if release in [listed for listed,_,_,_ in matrix]:
+        print(f"Skipping kernel tree {tree}: {release} is already listed")
+        continue
+    template,scope=None,""
+    if data.get('compile_db','native')=="native":
+        try:
+            template=compile_db.write(["ldd.c"],os.path.join(compile_db.CACHE_DIR,f"compile_commands-{release}.json"),tree)
+        except (RuntimeError,OSError) as e:
+            print(f"Warning: could not generate a compile database from {tree}: {e}")
+    if template is None:
+        # The running kernel's flags and headers say nothing about this tree,
+        # so its results must not be shared with any other tree.
+        template,scope=compile_template,f"{os.path.realpath(tree)}\n{release}"
+    matrix.append((release,tree,template,scope))
+queue=None
+gated=[]
+tracer=Tracer(enabled=bool(trace_dir))
 
+Prompts=namedtuple("Prompts",["full","edit","source"])
+Attempt=namedtuple("Attempt",["warnings","errors","completion","compile_seconds","patched"])
+Unit=namedtuple("Unit",["warnings","errors","completion","compile_seconds","tokens_saved","patched","discarded_tokens","iterations_saved"])
+
+
+def strip_fences(rtext):
+    lines=rtext.splitlines()
+    if lines and lines[0].strip().startswith("```"):
+        lines.pop(0)
+        if lines and lines[-1].strip()=="```":
+            lines.pop()
+    return "\n".join(lines)+"\n"
 
-for i in tqdm(range(iterations), desc="Running Iterations and Scoring"):
-    current_warnings=0
-    for j in tqdm(range(len(questions)),desc="Generating Code"):
-        if i==0:
-            response=client.models.generate_content(
-                model=model,contents=f"{questions[0]} - only provide code and refer to {style} for proper coding style and nothing else also make sure to remove 'c ``` at starting and ``` in' the end of the code and keep author name as Bhanu"
-            )
-            rtext=response.text
-            first_line = rtext.splitlines()[0]
-            
-            if first_line.strip() == "```c":
-                rtext.pop(0)
-                rtext.pop(len(rtext)-1)
-            else:
-                # print("First line is something else")
-                print("NO ``c \n")
 
-            with open(f"temp_ldd/ldd_{j}.c",'w') as f:
-                f.write(response.text)
-            with open("ldd.c",'w') as f:
-                f.write(response.text)
+def run_clang_tidy(ws):
+    if os.path.exists(ws.fixes):
+        os.remove(ws.fixes)
+    with tracer.span("clang-tidy") as span:
+        key=tidy_cache.key(ws,extra_args,kind="gated" if syntax_gate else "tidy") if tidy_cache else None
+        cached=tidy_cache.lookup(key,ws,{"fixes.yaml":ws.fixes}) if tidy_cache else None
+        span["cached"]=bool(cached)
+        if cached:
+            text,tier=cached[0],cached[1].get("tier","full")
+        elif queue:
+            result=queue.run("tidy",{"source":ws.source,"build_dir":ws.dir,"fixes":ws.fixes,"extra_args":extra_args,"gate":syntax_gate})
+            text,tier=result["output"],result["tier"]
+        elif analysis_server:
+            text,tier = analysis_server.diagnose(ws.source,ws.dir,ws.fixes,extra_args,syntax_gate)
         else:
-            with open(f"fixes/tidy_fixes_{j}.yaml",'r') as f:
-                fixes=yaml.safe_load(f)
-                
-            with open(f"temp_ldd/ldd_{j}.c",'r') as f:
-                fix_code=f.read()
-                
-            response=client.models.generate_content(
-                model=model,contents=f"Given <br> {fix_code} <br> ,these are the errors in it:{fixes}, fix the code and only provide code and nothing else also keep in mind to remove c ``` at starting and ``` in the end of the code and keep author name as Bhanu"
-            )
-            rtext=response.text
-            first_line = rtext.splitlines()[0]
-            
-            if first_line.strip() == "```c":
-                rtext.pop(0)
-                rtext.pop(len(rtext)-1)
-            else:
-                # print("First line is something else")
-                print("NO ``c \n")
-
-            with open(f"temp_ldd/ldd_{j}.c",'w') as f:
-                f.write(response.text)
-            
-            with open(f"ldd.c","w") as f:
-                f.write(response.text)
-                
-        
-        cmd = ["clang-tidy","ldd.c","-p",".","--extra-arg=-I/lib/modules/$(uname -r)/build/include",f"-export-fixes=fixes/tidy_fixes_{j}.yaml"]
-        out = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True, check=False)
-        text = out.stdout
-        
-        warning = len(re.findall(r":\d+:\d+:\s+warning:", text))
-        error   = len(re.findall(r":\d+:\d+:\s+error:", text))
-        if i==0:
-            warnings.append(warning)
-            errors.append(error)            
+            text,tier = run_tiers(ws.source,ws.dir,ws.fixes,extra_args,gate=syntax_gate)
+        if tidy_cache and not cached:
+            tidy_cache.store(key,ws,text,{"fixes.yaml":ws.fixes},{"tier":tier})
+        span["tier"]=tier
+        gated.append(tier=="syntax")
+        return text
+
+
+def run_kbuild(ws):
+    with tracer.span("kbuild",lane="kbuild") as span:
+        key=tidy_cache.key(ws,extra_args,kind="kbuild") if tidy_cache else None
+        cached=tidy_cache.lookup(key,ws,{"build.log":ws.build_log}) if tidy_cache else None
+        span["cached"]=bool(cached)
+        if cached:
+            text,meta=cached
+            return text,meta["built"],meta["seconds"]
+        if batcher:
+            text,built,seconds=batcher.build(ws)
+        elif queue:
+            result=queue.run("kbuild",{"dir":ws.dir,"kdir":kdir})
+            text,built,seconds=result["output"],result["built"],result["seconds"]
+        else:
+            text,built,seconds=kbuild.build_module(ws,kdir)
+        if tidy_cache:
+            # modpost resolves the driver's symbols against Module.symvers.
+            tidy_cache.store(key,ws,text,{"build.log":ws.build_log},{"built":built,"seconds":seconds},
+                             [os.path.join(os.path.realpath(kdir),"Module.symvers")])
+        return text,built,seconds
+
+
+def prepare_column(tree,template,scope,sources,root):
+    # Every driver against one kernel tree, with the results already cached
+    # for headers identical to a tree built before.
+    spaces=[]
+    for j,source in enumerate(sources):
+        ws=Workspace(j,root=root).prepare(template)
+        ws.write_source(source)
+        spaces.append(ws)
+    symvers=[os.path.join(os.path.realpath(tree),"Module.symvers")]
+    keys=[tidy_cache.key(ws,extra_args,kind="kbuild",scope=scope) if tidy_cache else None for ws in spaces]
+    results=[None]*len(spaces)
+    signatures={}
+    for j,ws in enumerate(spaces):
+        cached=tidy_cache.lookup(keys[j],ws,{"build.log":ws.build_log}) if tidy_cache else None
+        if cached:
+            results[j]=(cached[0],cached[1]["built"],cached[1]["seconds"])
         else:
-            warnings[j]=warning
-            errors[j]=error
-            
-        # except Exception as e:
-        #     print(f"Error occured : \n {e}")
-            
-    compile_rate=0
-    warninghandling_score=0
-    for j in errors:
-        if j==0:
-            compile_rate+=1
+            signatures[j]=tidy_cache.signature(keys[j],ws,symvers) if tidy_cache else (tree,j)
+    return {"spaces":spaces,"keys":keys,"results":results,"signatures":signatures,"symvers":symvers}
+
+
+def build_column(release,tree,template,column,owned):
+    # One kbuild pass for the drivers this tree has to build itself.
+    if not owned:
+        return
+    with open(template,'r') as f:
+        cc=json.load(f)[0]["arguments"][0]
+    with tracer.span("kbuild",lane=f"kernel {release}",objects=len(owned)):
+        jobs=max(1,(os.cpu_count() or 1)//len(matrix))
+        spaces=[column["spaces"][j] for j in owned]
+        built=kbuild.build_batch(spaces,os.path.join(os.path.dirname(spaces[0].dir),"batch"),tree,cc,jobs)
+    for j,result in zip(owned,built):
+        column["results"][j]=result
+
+
+def tally(column):
+    counts={"built":0,"total":len(column["spaces"]),"warnings":0,"errors":0,"failed":[]}
+    for j,(text,built,_) in enumerate(column["results"]):
+        warning,error=diagnostics.count(diagnostics.dedupe(diagnostics.parse(text.splitlines())))
+        counts["warnings"]+=warning
+        counts["errors"]+=error
+        if built:
+            counts["built"]+=1
+        else:
+            counts["failed"].append(j)
+    return counts
+
+
+async def kernel_matrix(subdir,workspaces):
+    # The trees are built in parallel, each with its share of the CPUs. A
+    # driver whose headers are the same in several trees is built in the
+    # first of them only and its result reused for the others.
+    sources=[ws.read_source() for ws in workspaces]
+    columns=await asyncio.gather(*(
+        asyncio.to_thread(prepare_column,tree,template,scope,sources,os.path.join("work",subdir,"kernels",release))
+        for release,tree,template,scope in matrix
+    ))
+    owners={}
+    for c,column in enumerate(columns):
+        for j,signature in column["signatures"].items():
+            owners.setdefault(signature,(c,j))
+    await asyncio.gather(*(
+        asyncio.to_thread(build_column,release,tree,template,column,
+                          [j for j,signature in column["signatures"].items() if owners[signature]==(c,j)])
+        for c,((release,tree,template,_),column) in enumerate(zip(matrix,columns))
+    ))
+    for c,column in enumerate(columns):
+        for j,signature in column["signatures"].items():
+            owner,k=owners[signature]
+            ws=column["spaces"][j]
+            if (owner,k)!=(c,j):
+                text,built,seconds=columns[owner]["results"][k]
+                column["results"][j]=(text.replace(columns[owner]["spaces"][k].dir,ws.dir),built,seconds)
+                with open(ws.build_log,'w') as f:
+                    f.write(column["results"][j][0])
+            if tidy_cache:
+                text,built,seconds=column["results"][j]
+                tidy_cache.store(column["keys"][j],ws,text,{"build.log":ws.build_log},{"built":built,"seconds":seconds},column["symvers"])
+    return {release:tally(column) for (release,_,_,_),column in zip(matrix,columns)}
+
+
+def ingest(ws,text,build_text):
+    with tracer.span("parse"):
+        records=diagnostics.dedupe(diagnostics.parse(text.splitlines()))
+    with tracer.span("yaml-load"):
+        ws.exported=diagnostics.load_fixes(ws.fixes)
+    diagnostics.attach_replacements(records,ws.exported,ws.read_source())
+    with tracer.span("parse"):
+        build_records=diagnostics.dedupe(diagnostics.parse(build_text.splitlines()))
+    ws.diagnostics=diagnostics.merge(records,build_records)
+    ws.build_diagnostics=build_records
+    return diagnostics.count(ws.diagnostics)
+
+
+async def analyze(ws,analysis_slots):
+    async def tidy():
+        async with analysis_slots:
+            return await asyncio.to_thread(run_clang_tidy,ws)
+
+    if not compile_stage:
+        return ingest(ws,await tidy(),"")+(None,)
+
+    if batcher:
+        # A kbuild batch is one parallel make of its own, so waiting for it
+        # must not hold an analysis slot or the batch never fills up.
+        text,(build_text,built,compile_seconds)=await asyncio.gather(tidy(),asyncio.to_thread(run_kbuild,ws))
+    else:
+        async with analysis_slots:
+            text,(build_text,built,compile_seconds)=await asyncio.gather(
+                asyncio.to_thread(run_clang_tidy,ws),
+                asyncio.to_thread(run_kbuild,ws),
+            )
+    warning,error=ingest(ws,text,build_text)
+    if not built and error==0:
+        error=1
+    return warning,error,compile_seconds
+
+
+def combine(first,second):
+    return Completion(second.text,first.prompt_tokens+second.prompt_tokens,first.output_tokens+second.output_tokens,first.latency+second.latency)
+
+
+def build_prompts(ws,i,j):
+    tokens_saved=0
     if i==0:
-        for j in warnings:
-            total_warning+=j
-        current_warnings=total_warning
+        prompt=f"{questions[j]} - only provide code and refer to {style} for proper coding style and nothing else also make sure to remove 'c ``` at starting and ``` in' the end of the code and keep author name as Bhanu"
+        return Prompts(prompt,None,None),tokens_saved
+
+    fixes=ws.exported
+    build_errors=[record.format() for record in ws.build_diagnostics]
+    fix_code=ws.read_source()
+    report=f"{fixes}"
+    if build_errors:
+        report+=f" and the kernel build reported:{build_errors}"
+    if digest_config.get('enabled',True):
+        digest=build_digest(ws.diagnostics,fix_code,ws.source,digest_config.get('context_lines',2),digest_config.get('token_cap',2000))
+        tokens_saved=estimate_tokens(report)-estimate_tokens(digest)
+        prompt=f"Given <br> {fix_code} <br> ,these are the errors in it (file:line:col level [check] message, then the driver source around it):\n{digest}\n"
     else:
-        
-        for j in warnings:
-            current_warnings+=j
-        
-    warninghandling_score=(total_warning-current_warnings)/total_warning
-    
-    compile_score=compile_rate/5
-    total_score=warninghandling_score*0.5 + compile_score*0.5
-    
-    entry={
-        "Iteration": i+1,
-        "Unsuccessful compilation":5-compile_rate,
-        "warnings":current_warnings,
-        "compile_score": compile_score,
-        "warninghandling_score": warninghandling_score,
-        "Total_score": total_score
-    }
-    filename="scores.yaml"
-    if os.path.exists(filename):
-        with open(filename,'r') as f:
-            data=yaml.safe_load(f) or []
+        prompt=f"Given <br> {fix_code} <br> ,these are the errors in it:{report}"
+    edit_prompt=prompt+f", fix the code and keep author name as Bhanu. {EDIT_INSTRUCTIONS}"
+    prompt+=", fix the code and only provide code and nothing else also keep in mind to remove c ``` at starting and ``` in the end of the code and keep author name as Bhanu"
+    return Prompts(prompt,edit_prompt,fix_code),tokens_saved
+
+
+async def generate(llm,prompt,variant):
+    with tracer.span("llm") as span:
+        completion=await llm.generate(prompt,variant)
+        span.update(prompt_tokens=completion.prompt_tokens,output_tokens=completion.output_tokens)
+    return completion
+
+
+async def attempt(llm,analysis_slots,ws,prompts,variant=0,spent=None,inflight=None):
+    # `spent` collects every completed LLM call, so a caller that cancels the
+    # attempt can still account for its tokens. `inflight` collects the
+    # analysis task, which keeps running in its threads after a cancel.
+    async def call(prompt):
+        completion=await generate(llm,prompt,variant)
+        if spent is not None:
+            spent.append(completion)
+        return completion
+
+    code=None
+    patched=None
+    if prompts.edit and refine_mode=="edits":
+        edit=await call(prompts.edit)
+        try:
+            with tracer.span("patch"):
+                code=apply_response(prompts.source,edit.text)
+            completion=edit
+            patched=True
+        except PatchError:
+            # Fall back to regenerating the whole file.
+            completion=combine(edit,await call(prompts.full))
+            patched=False
     else:
-        data=[]
-        
-    data.append(entry)
-    
-    with open(filename,'w') as f:
-        yaml.dump(data,f,default_flow_style=False)
-        
-        
-            
-    
-    
-        
-        
-        
-        
\ No newline at end of file
+        completion=await call(prompts.full)
+    if code is None:
+        with tracer.span("strip-fences"):
+            code=strip_fences(completion.text)
+    with tracer.span("write"):
+        ws.write_source(normalize_source(code))
+
+    # Shielded, so cancelling the attempt cannot release the analysis slot
+    # while clang-tidy and kbuild are still running in their threads.
+    analysis=asyncio.ensure_future(analyze(ws,analysis_slots))
+    if inflight is not None:
+        inflight.append(analysis)
+    warning,error,compile_seconds=await asyncio.shield(analysis)
+    return Attempt(warning,error,completion,compile_seconds,patched)
+
+
+# Candidate analyses per question that may still be running after their
+# attempt was cancelled.
+candidate_analyses={}
+
+
+async def speculate(llm,analysis_slots,ws,prompts):
+    # Best-of-N: K candidates are generated and analyzed concurrently in
+    # their own workspaces. The one with the fewest errors, then warnings,
+    # becomes the question's source; once any candidate is clean the rest
+    # are cancelled.
+    # A cancelled candidate's analysis from the last round must finish before
+    # its directory is reused; otherwise it could overwrite the new fixes and
+    # build log, or cache results for the old source under the new one.
+    await asyncio.gather(*candidate_analyses.pop(ws.dir,[]),return_exceptions=True)
+    running=candidate_analyses.setdefault(ws.dir,[])
+    workspaces=[ws.candidate(k).prepare(compile_template) for k in range(candidates)]
+    spent={k:[] for k in range(candidates)}
+
+    async def run(k):
+        tag(candidate=k)
+        try:
+            return k,await attempt(llm,analysis_slots,workspaces[k],prompts,k,spent[k],running)
+        except RecordedCancellation:
+            # Replaying a candidate that lost the race when recorded.
+            return k,None
+
+    tasks=[asyncio.create_task(run(k)) for k in range(candidates)]
+    finished={}
+    try:
+        for next_done in asyncio.as_completed(tasks):
+            k,result=await next_done
+            if result is None:
+                continue
+            finished[k]=result
+            if result.errors==0 and result.warnings==0:
+                break
+    finally:
+        for task in tasks:
+            task.cancel()
+        await asyncio.gather(*tasks,return_exceptions=True)
+
+    best=min(finished,key=lambda k:(finished[k].errors,finished[k].warnings,k))
+    ws.adopt(workspaces[best])
+    winner=finished[best]
+    # Cancelled candidates still paid for the LLM calls they completed.
+    cancelled=[completion for k in spent if k not in finished for completion in spent[k]]
+    completion=Completion(
+        winner.completion.text,
+        sum(result.completion.prompt_tokens for result in finished.values())+sum(c.prompt_tokens for c in cancelled),
+        sum(result.completion.output_tokens for result in finished.values())+sum(c.output_tokens for c in cancelled),
+        winner.completion.latency,
+    )
+    discarded=sum(result.completion.prompt_tokens+result.completion.output_tokens for k,result in finished.items() if k!=best)
+    discarded+=sum(c.prompt_tokens+c.output_tokens for c in cancelled)
+    # Lower bound on iterations saved: the clean winner replaced a first
+    # candidate that finished with diagnostics left.
+    saved=int(winner.errors==0 and winner.warnings==0 and 0 in finished and finished[0].errors+finished[0].warnings>0)
+    return winner._replace(completion=completion),discarded,saved
+
+
+async def run_question(llm,analysis_slots,ws,i,j):
+    tag(question=j,iteration=i+1)
+    with tracer.span("prompt-build"):
+        prompts,tokens_saved=build_prompts(ws,i,j)
+    if candidates>1:
+        result,discarded,saved=await speculate(llm,analysis_slots,ws,prompts)
+    else:
+        result,discarded,saved=await attempt(llm,analysis_slots,ws,prompts),0,0
+    with tracer.span("write"):
+        ws.publish()
+    ws.history.append({"iteration":i+1,"prompt":prompts.edit if prompts.edit and refine_mode=="edits" else prompts.full,"response":result.completion.text})
+    return Unit(result.warnings,result.errors,result.completion,result.compile_seconds,tokens_saved,result.patched,discarded,saved)
+
+
+def unit_state(unit):
+    return {**unit._asdict(),"completion":list(unit.completion)}
+
+
+def unit_from_state(saved):
+    return Unit(**{**saved,"completion":Completion(*saved["completion"])})
+
+
+def make_llm(model):
+    if args.replay:
+        return ReplayLLM(ResponseStore(args.replay),model)
+    llm=AsyncLLM.from_config(api_key,model,llm_config)
+    if args.record:
+        llm=RecordingLLM(llm,ResponseStore(args.record))
+    return llm
+
+
+async def evaluate(model,position,analysis_slots,budget,store,run_id):
+    total_warning=0
+    tag(model=model)
+    llm=make_llm(model)
+    # A single-model run keeps the old work/q<N> and temp_ldd/ldd_<N>.c layout.
+    subdir="" if len(models)==1 else model.replace("/","_")
+    workspaces=[Workspace(j,root=os.path.join("work",subdir),artifacts=subdir).prepare(compile_template) for j in range(len(questions))]
+    scheduler=Scheduler(len(questions),budget=budget,**scheduler_config)
+    checkpoint=Checkpoint(run_id,model,checkpoint_dir)
+    saved=checkpoint.load() if args.resume else None
+    if saved and saved.get("summary"):
+        return saved["summary"]
+    if not saved:
+        store.start_run(run_id,model,data)
+    progress=tqdm(desc=f"{model}: Running Iterations and Scoring",position=position)
+    started=time.monotonic()
+    latencies=[]
+    prompt_tokens=output_tokens=tokens_saved=0
+    patches={True:0,False:0}
+    discarded_tokens=iterations_saved=0
+    entry={}
+    i=0
+    pending={}
+
+    if saved:
+        # Pick up from the last completed round; units that finished after
+        # it are reused below instead of being sent to the LLM again.
+        counters=saved["counters"]
+        i,total_warning,entry,latencies=counters["round"],counters["total_warning"],counters["entry"],counters["latencies"]
+        prompt_tokens,output_tokens,tokens_saved=counters["prompt_tokens"],counters["output_tokens"],counters["tokens_saved"]
+        patches={True:counters["patches"][0],False:counters["patches"][1]}
+        discarded_tokens,iterations_saved=counters["discarded_tokens"],counters["iterations_saved"]
+        started-=counters["elapsed"]
+        budget.started=min(budget.started,time.monotonic()-counters["budget_elapsed"])
+        budget.charge(Completion("",prompt_tokens,output_tokens,0.0))
+        scheduler.restore(saved["scheduler"])
+        for j,snapshot in saved["workspaces"].items():
+            workspaces[int(j)].restore(snapshot)
+        pending={int(j):unit for j,unit in saved["pending"].items()}
+        progress.update(i)
+
+    def boundary():
+        return {
+            "round":i,"total_warning":total_warning,"entry":entry,"latencies":latencies,
+            "prompt_tokens":prompt_tokens,"output_tokens":output_tokens,"tokens_saved":tokens_saved,
+            "patches":[patches[True],patches[False]],"discarded_tokens":discarded_tokens,"iterations_saved":iterations_saved,
+            "elapsed":time.monotonic()-started,"budget_elapsed":time.monotonic()-budget.started,
+        }
+
+    state={
+        "counters":boundary(),
+        "scheduler":scheduler.snapshot(),
+    }
+    checkpoint.save(state)
+
+    async def run_unit(j):
+        iteration=scheduler.iteration(j)
+        if j in pending and pending[j]["iteration"]==iteration:
+            return unit_from_state(pending[j]["unit"])
+        result=await run_question(llm,analysis_slots,workspaces[j],iteration,j)
+        pending[j]={"iteration":iteration,"unit":unit_state(result)}
+        checkpoint.save_unit(j,workspaces[j].snapshot(),pending[j],workspaces[j].history[-1])
+        return result
+
+    while True:
+        active=scheduler.next_round()
+        if not active:
+            break
+        current_warnings=0
+        results=await asyncio.gather(*(run_unit(j) for j in active))
+        compile_seconds={}
+        for j,unit in zip(active,results):
+            store.add_unit(run_id,model,j,scheduler.iteration(j),unit.warnings,unit.errors,unit.compile_seconds,unit.completion,unit.tokens_saved)
+            scheduler.record(j,unit.warnings,unit.errors,unit.completion)
+            latencies.append(unit.completion.latency)
+            prompt_tokens+=unit.completion.prompt_tokens
+            output_tokens+=unit.completion.output_tokens
+            tokens_saved+=unit.tokens_saved
+            if unit.patched is not None:
+                patches[unit.patched]+=1
+            discarded_tokens+=unit.discarded_tokens
+            iterations_saved+=unit.iterations_saved
+            if unit.compile_seconds is not None:
+                compile_seconds[j]=round(unit.compile_seconds,3)
+        with tracer.span("scoring",iteration=i+1):
+            scheduler.settle()
+            warnings=[state.warnings for state in scheduler.states]
+            errors=[state.errors for state in scheduler.states]
+
+            compile_rate=0
+            warninghandling_score=0
+            for j in errors:
+                if j==0:
+                    compile_rate+=1
+            if i==0:
+                for j in warnings:
+                    total_warning+=j
+                current_warnings=total_warning
+            else:
+
+                for j in warnings:
+                    current_warnings+=j
+
+            warninghandling_score=(total_warning-current_warnings)/total_warning if total_warning else 1.0
+
+            compile_score=compile_rate/len(questions)
+            total_score=warninghandling_score*0.5 + compile_score*0.5
+
+            entry={
+                "Iteration": i+1,
+                "Unsuccessful compilation":len(questions)-compile_rate,
+                "warnings":current_warnings,
+                "compile_score": compile_score,
+                "warninghandling_score": warninghandling_score,
+                "Total_score": total_score,
+                "stop_reasons": scheduler.stop_reasons(),
+                "compile_seconds": compile_seconds
+            }
+            store.add_score(run_id,model,entry)
+        i+=1
+        progress.update()
+        pending.clear()
+        state["counters"]=boundary()
+        state["scheduler"]=scheduler.snapshot()
+        checkpoint.save(state)
+
+    progress.close()
+    kernels=await kernel_matrix(subdir,workspaces) if matrix else {}
+    client=getattr(llm,"llm",llm)
+    calls=client.latency_summary() if hasattr(client,"latency_summary") else {}
+    summary={
+        "model": model,
+        "iterations": i,
+        "compile_score": entry.get("compile_score",0.0),
+        "warninghandling_score": entry.get("warninghandling_score",0.0),
+        "total_score": entry.get("Total_score",0.0),
+        "latency_mean": statistics.fmean(latencies) if latencies else 0.0,
+        "latency_p50": percentile(latencies,0.50),
+        "latency_p95": percentile(latencies,0.95),
+        "latency_p99": percentile(latencies,0.99),
+        "prompt_tokens": prompt_tokens,
+        "output_tokens": output_tokens,
+        "tokens_saved": tokens_saved,
+        "patches_applied": patches[True],
+        "patches_failed": patches[False],
+        "discarded_tokens": discarded_tokens,
+        "iterations_saved": iterations_saved,
+        "elapsed": time.monotonic()-started,
+        "stop_reasons": scheduler.stop_reasons(),
+        "retries": calls.get("retries",0),
+        "hedges": calls.get("hedges",0),
+        "hedge_wins": calls.get("hedge_wins",0),
+        "stages": tracer.summary(model),
+        "kernel_matrix": kernels,
+    }
+    store.finish_run(run_id,model,summary)
+    state["summary"]=summary
+    checkpoint.save(state)
+    return summary
+
+
+def print_matrix(summaries):
+    header=f"{'model':<28}{'iters':>6}{'compile':>9}{'warnings':>10}{'total':>8}{'lat mean':>10}{'lat p50':>9}{'lat p95':>9}{'lat p99':>9}{'tok in':>10}{'tok out':>10}"
+    print(header)
+    print("-"*len(header))
+    for row in sorted(summaries,key=lambda row: row["total_score"],reverse=True):
+        print(f"{row['model']:<28}{row['iterations']:>6}{row['compile_score']:>9.3f}{row['warninghandling_score']:>10.3f}{row['total_score']:>8.3f}"
+              f"{row['latency_mean']:>9.2f}s{row['latency_p50']:>8.2f}s{row['latency_p95']:>8.2f}s{row['latency_p99']:>8.2f}s{row['prompt_tokens']:>10}{row['output_tokens']:>10}")
+
+
+def print_kernel_matrix(summaries):
+    releases=[release for release,_,_,_ in matrix]
+    header=f"{'model':<28}"+"".join(f"{release:>24}" for release in releases)+f"{'portable':>10}"
+    print(header)
+    print("-"*len(header))
+    for row in summaries:
+        columns=[row.get("kernel_matrix",{}).get(release) for release in releases]
+        columns=[column or {"built":0,"total":0,"errors":0,"failed":[]} for column in columns]
+        built=sum(column["built"] for column in columns)
+        total=sum(column["total"] for column in columns) or 1
+        cells="".join(f"{column['built']}/{column['total']} ({column['errors']} err)".rjust(24) for column in columns)
+        print(f"{row['model']:<28}{cells}{built/total:>10.3f}")
+        for release,column in zip(releases,columns):
+            if column["failed"]:
+                print(f"  {release}: questions {column['failed']} do not build")
+
+
+async def main():
+    global queue
+    analysis_slots=asyncio.Semaphore(workers)
+    budget=Budget.from_config(budget_config)
+    store=ResultsStore(data.get('results','results.db'))
+    run_id=new_run_id()
+    if args.resume:
+        run_id=latest_run(checkpoint_dir) if args.resume=="latest" else args.resume
+        if run_id is None:
+            parser.error(f"no checkpoints to resume in {checkpoint_dir}")
+        print(f"Resuming run {run_id}")
+    children=[]
+    # Every slot can have a clang-tidy and a kbuild thread blocked at once,
+    # plus a full kbuild batch waiting to be built; the default executor is
+    # smaller than that once `workers` is large.
+    asyncio.get_running_loop().set_default_executor(ThreadPoolExecutor(2*workers+(batcher.max_batch if batcher else 0)))
+    if queue_config.get('enabled'):
+        queue=WorkQueue(queue_config.get('path','.cache/queue.db'),campaign=run_id)
+        # Workers reach the same PCH analysis server as main.py would.
+        queue.workers=children=spawn(queue.path,queue_config.get('local_workers',os.cpu_count()),
+                                     ["--lease",str(queue_config.get('lease_seconds',600)),
+                                      "--analysis-server",os.path.abspath(data.get('analysis_server','.cache/analysis.sock'))])
+
+    # Every model runs its own rounds concurrently; they share the analysis
+    # workers, the global budget and the content-addressed result cache.
+    try:
+        summaries=await asyncio.gather(*(evaluate(model,position,analysis_slots,budget,store,run_id) for position,model in enumerate(models)))
+    finally:
+        for child in children:
+            child.terminate()
+        if queue:
+            queue.purge()
+
+    print(f"Run {run_id} recorded in {data.get('results','results.db')}")
+    print_matrix(summaries)
+    if matrix:
+        print_kernel_matrix(summaries)
+    for row in summaries:
+        print(f"{row['model']} stopped: {row['stop_reasons']}")
+        if row['retries'] or row['hedges']:
+            print(f"{row['model']}: {row['retries']} retries, {row['hedges']} hedged requests ({row['hedge_wins']} won by the hedge)")
+        if row['tokens_saved']:
+            print(f"{row['model']}: diagnostic digest saved {row['tokens_saved']} prompt tokens")
+        if row['patches_applied'] or row['patches_failed']:
+            print(f"{row['model']}: {row['patches_applied']} edits applied, {row['patches_failed']} fell back to full regeneration")
+        if candidates>1:
+            print(f"{row['model']}: best-of-{candidates} saved at least {row['iterations_saved']} iterations; "
+                  f"{row['discarded_tokens']} tokens went to discarded candidates, {row['elapsed']:.1f}s wall clock")
+    print(f"Spent {budget.spent_tokens} tokens, ${budget.spent_usd:.4f}")
+    if tidy_cache:
+        print(f"Analysis cache: {tidy_cache.hits} hits, {tidy_cache.misses} misses")
+    if batcher and batcher.batches:
+        print(f"Batched kbuild: {batcher.objects} drivers in {batcher.batches} passes")
+    if syntax_gate:
+        print(f"Syntax gate: {sum(gated)} of {len(gated)} analyses stopped before the clang-analyzer checks")
+    if tracer.enabled:
+        trace=os.path.join(trace_dir,f"{run_id}.json")
+        tracer.export(trace)
+        print(f"Per-stage latency (trace written to {trace}):")
+        print_summary(tracer.summary())
+
+
+try:
+    asyncio.run(main())
+finally:
+    if staging_config.get('enabled'):
+        sync_back(os.getcwd(),origin,staged_dbs,staged_artifacts)
@@ -0,0 +1,149 @@
+import argparse
+import itertools
+import json
+import math
+import random
+import re
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+# Local stand-in for the Gemini generateContent endpoint. Point the harness at
+# it with "base_url" in the "llm" section of config.json to run offline.
+
+ROUTE = re.compile(r"^/v1beta/models/(?P<model>[^/:]+):generateContent$")
+
+
+class MockLLM:
+    def __init__(self, corpus, latency=1.0, jitter=0.25, tokens_per_second=0.0, seed=None, edit_rate=1.0,
+                 spike_rate=0.0, spike_latency=10.0, error_rate=0.0, error_code=503, distribution="normal"):
+        self.responses = []
+        for path in corpus:
+            with open(path, 'r') as f:
+                self.responses.append(f.read())
+        self.cycle = itertools.cycle(self.responses)
+        self.latency = latency
+        self.jitter = jitter
+        self.tokens_per_second = tokens_per_second
+        self.edit_rate = edit_rate
+        self.spike_rate = spike_rate
+        self.spike_latency = spike_latency
+        self.error_rate = error_rate
+        self.error_code = error_code
+        self.distribution = distribution
+        self.random = random.Random(seed)
+        self.lock = threading.Lock()
+
+    def next_response(self):
+        with self.lock:
+            text = next(self.cycle)
+            delay = self.sample_latency()
+            if self.random.random() < self.spike_rate:
+                delay += self.spike_latency
+        return text, delay
+
+    def sample_latency(self):
+        # normal: mean `latency`, standard deviation `jitter`.
+        # lognormal: median `latency`, shape `jitter`; long right tail like real APIs.
+        # exponential: mean `latency`.
+        if self.latency <= 0:
+            return 0.0
+        if self.distribution == "lognormal":
+            return self.random.lognormvariate(math.log(self.latency), self.jitter)
+        if self.distribution == "exponential":
+            return self.random.expovariate(1.0 / self.latency)
+        return max(0.0, self.random.gauss(self.latency, self.jitter))
+
+    def fail(self):
+        with self.lock:
+            return self.random.random() < self.error_rate
+
+    def edit(self, prompt):
+        # Answer edit-mode prompts with a small SEARCH/REPLACE block against
+        # the first line of the code quoted in the prompt.
+        match = re.search(r"Given <br> (.+?)\n", prompt)
+        if not match or "<<<<<<< SEARCH" not in prompt:
+            return None
+        with self.lock:
+            if self.random.random() >= self.edit_rate:
+                return None
+        line = match.group(1)
+        return f"<<<<<<< SEARCH\n{line}\n=======\n{line}\n/* reviewed */\n>>>>>>> REPLACE\n"
+
+    def complete(self, prompt):
+        code, delay = self.next_response()
+        text = self.edit(prompt) or f"```c\n{code}```\n"
+        prompt_tokens = max(1, len(prompt) // 4)
+        output_tokens = max(1, len(text) // 4)
+        if self.tokens_per_second:
+            delay += output_tokens / self.tokens_per_second
+        time.sleep(delay)
+        return {
+            "candidates": [{"content": {"role": "model", "parts": [{"text": text}]}, "finishReason": "STOP", "index": 0}],
+            "usageMetadata": {
+                "promptTokenCount": prompt_tokens,
+                "candidatesTokenCount": output_tokens,
+                "totalTokenCount": prompt_tokens + output_tokens,
+            },
+        }
+
+
+def make_handler(mock):
+    class Handler(BaseHTTPRequestHandler):
+        def do_POST(self):
+            match = ROUTE.match(self.path.split("?")[0])
+            if not match:
+                self.send_error(404)
+                return
+            body = json.loads(self.rfile.read(int(self.headers.get("Content-Length", 0))) or b"{}")
+            if mock.fail():
+                payload = json.dumps({"error": {"code": mock.error_code, "message": "injected by mock_llm", "status": "UNAVAILABLE"}}).encode()
+                self.send_response(mock.error_code)
+                self.send_header("Content-Type", "application/json")
+                self.send_header("Content-Length", str(len(payload)))
+                self.end_headers()
+                self.wfile.write(payload)
+                return
+            prompt = "".join(part.get("text", "") for content in body.get("contents", []) for part in content.get("parts", []))
+            payload = json.dumps(mock.complete(prompt)).encode()
+            self.send_response(200)
+            self.send_header("Content-Type", "application/json")
+            self.send_header("Content-Length", str(len(payload)))
+            self.end_headers()
+            self.wfile.write(payload)
+
+        def log_message(self, format, *args):
+            pass
+
+    return Handler
+
+
+def make_server(mock, host="127.0.0.1", port=8080):
+    server = ThreadingHTTPServer((host, port), make_handler(mock))
+    server.daemon_threads = True
+    return server
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Mock Gemini server for offline runs of main.py")
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--latency", type=float, default=1.0, help="mean response latency in seconds")
+    parser.add_argument("--jitter", type=float, default=0.25, help="standard deviation of the latency in seconds (shape for lognormal)")
+    parser.add_argument("--distribution", choices=["normal", "lognormal", "exponential"], default="normal")
+    parser.add_argument("--tokens-per-second", type=float, default=0.0, help="extra delay per output token (0 disables)")
+    parser.add_argument("--seed", type=int, default=None)
+    parser.add_argument("--spike-rate", type=float, default=0.0, help="fraction of requests delayed by --spike-latency")
+    parser.add_argument("--spike-latency", type=float, default=10.0, help="extra seconds added to a latency spike")
+    parser.add_argument("--error-rate", type=float, default=0.0, help="fraction of requests answered with an HTTP error")
+    parser.add_argument("--error-code", type=int, default=503)
+    parser.add_argument("--edit-rate", type=float, default=1.0, help="fraction of edit-mode prompts answered with an edit instead of a full file")
+    parser.add_argument("corpus", nargs="*", default=["ldd.c"], help="driver sources served round-robin")
+    args = parser.parse_args()
+
+    mock = MockLLM(args.corpus, args.latency, args.jitter, args.tokens_per_second, args.seed, args.edit_rate,
+                   args.spike_rate, args.spike_latency, args.error_rate, args.error_code, args.distribution)
+    server = make_server(mock, args.host, args.port)
+    print(f"Mock LLM listening on http://{args.host}:{args.port}")
+    server.serve_forever()
@@ -0,0 +1,94 @@
+import re
+
+
+EDIT = re.compile(r"<<<<<<< SEARCH\n(?P<search>.*?)\n?=======\n(?P<replace>.*?)\n?>>>>>>> REPLACE", re.S)
+HUNK = re.compile(r"^@@ -\d+(?:,\d+)? \+\d+(?:,\d+)? @@")
+
+EDIT_INSTRUCTIONS = (
+    "Do not repeat the whole file. Answer only with one or more edits in this exact format, "
+    "where SEARCH is copied verbatim from the current code and appears in it exactly once:\n"
+    "<<<<<<< SEARCH\n<lines to replace>\n=======\n<new lines>\n>>>>>>> REPLACE"
+)
+
+
+class PatchError(ValueError):
+    pass
+
+
+def _replace_once(source, search, replace):
+    # Match whole lines ignoring surrounding whitespace first, since models
+    # often get indentation or trailing spaces slightly wrong; fall back to
+    # an exact substring for edits inside a single line.
+    lines = source.split("\n")
+    wanted = [line.strip() for line in search.split("\n")]
+    matches = [n for n in range(len(lines) - len(wanted) + 1)
+               if [line.strip() for line in lines[n:n + len(wanted)]] == wanted]
+    if len(matches) == 1:
+        n = matches[0]
+        return "\n".join(lines[:n] + replace.split("\n") + lines[n + len(wanted):])
+    if len(matches) > 1:
+        raise PatchError(f"search block is ambiguous ({len(matches)} matches): {search[:80]!r}")
+
+    count = source.count(search)
+    if count != 1:
+        raise PatchError(f"search block matches {count} places: {search[:80]!r}")
+    return source.replace(search, replace, 1)
+
+
+def apply_edits(source, text):
+    edits = list(EDIT.finditer(text))
+    if not edits:
+        raise PatchError("no SEARCH/REPLACE blocks in response")
+    for edit in edits:
+        search = edit["search"]
+        if not search.strip():
+            raise PatchError("empty search block")
+        source = _replace_once(source, search, edit["replace"])
+    return source
+
+
+def apply_unified(source, text):
+    # Hunks are located by their context and removed lines rather than by
+    # line numbers, which models rarely get right. The ---/+++ file headers
+    # come before a file's first hunk, where lines are ignored; inside a hunk
+    # "--- x" is the removed line "-- x".
+    hunks = []
+    current = None
+    for line in text.split("\n"):
+        if HUNK.match(line):
+            current = ([], [])
+            hunks.append(current)
+        elif line.startswith("diff "):
+            # The next file's headers follow.
+            current = None
+        elif current is not None and line[:1] in (" ", "-", "+", ""):
+            before, after = current
+            if line[:1] in (" ", ""):
+                before.append(line[1:])
+                after.append(line[1:])
+            elif line[:1] == "-":
+                before.append(line[1:])
+            else:
+                after.append(line[1:])
+    if not hunks:
+        raise PatchError("no unified diff hunks in response")
+    for before, after in hunks:
+        while before and after and before[-1] == "" and after[-1] == "":
+            before.pop()
+            after.pop()
+        if not before:
+            raise PatchError("hunk has no context to anchor it")
+        source = _replace_once(source, "\n".join(before), "\n".join(after))
+    return source
+
+
+def apply_response(source, text):
+    if "<<<<<<< SEARCH" in text:
+        patched = apply_edits(source, text)
+    elif re.search(r"^@@ ", text, re.M):
+        patched = apply_unified(source, text)
+    else:
+        raise PatchError("response is neither SEARCH/REPLACE edits nor a unified diff")
+    if not patched.strip():
+        raise PatchError("patch produced an empty file")
+    return patched
@@ -0,0 +1,170 @@
+import argparse
+import json
+import sqlite3
+import time
+import uuid
+
+import yaml
+
+
+RESULTS_DB = "results.db"
+
+SCHEMA = """
+CREATE TABLE IF NOT EXISTS runs (
+    run_id TEXT,
+    model TEXT,
+    started_at REAL,
+    config TEXT,
+    summary TEXT,
+    PRIMARY KEY (run_id, model)
+);
+CREATE TABLE IF NOT EXISTS units (
+    run_id TEXT,
+    model TEXT,
+    question INTEGER,
+    iteration INTEGER,
+    warnings INTEGER,
+    errors INTEGER,
+    compile_seconds REAL,
+    prompt_tokens INTEGER,
+    output_tokens INTEGER,
+    latency REAL,
+    recorded_at REAL,
+    tokens_saved INTEGER
+);
+CREATE TABLE IF NOT EXISTS scores (
+    run_id TEXT,
+    model TEXT,
+    iteration INTEGER,
+    unsuccessful INTEGER,
+    warnings INTEGER,
+    compile_score REAL,
+    warninghandling_score REAL,
+    total_score REAL,
+    stop_reasons TEXT,
+    compile_seconds TEXT,
+    recorded_at REAL
+);
+CREATE INDEX IF NOT EXISTS runs_started ON runs (started_at);
+CREATE INDEX IF NOT EXISTS units_key ON units (run_id, model, question, iteration);
+CREATE INDEX IF NOT EXISTS scores_key ON scores (run_id, model, iteration);
+CREATE INDEX IF NOT EXISTS scores_model ON scores (model, total_score);
+"""
+
+
+def new_run_id():
+    return f"{time.strftime('%Y%m%d-%H%M%S')}-{uuid.uuid4().hex[:6]}"
+
+
+class ResultsStore:
+    # Units and scored iterations are append-only, one INSERT per transaction,
+    # so a crash can lose at most the row being written.
+    def __init__(self, path=RESULTS_DB):
+        self.db = sqlite3.connect(path)
+        self.db.execute("PRAGMA journal_mode=WAL")
+        self.db.executescript(SCHEMA)
+
+    def start_run(self, run_id, model, config):
+        with self.db:
+            self.db.execute("INSERT OR IGNORE INTO runs (run_id, model, started_at, config) VALUES (?,?,?,?)", (run_id, model, time.time(), json.dumps(config)))
+
+    def finish_run(self, run_id, model, summary):
+        # Per-model totals, including LLM latency percentiles, retries and hedges.
+        with self.db:
+            self.db.execute("UPDATE runs SET summary=? WHERE run_id=? AND model=?", (json.dumps(summary), run_id, model))
+
+    # Both inserts skip a row that is already there: a run resumed after a
+    # crash in the middle of a round records that round again.
+    def add_unit(self, run_id, model, question, iteration, warnings, errors, compile_seconds, completion, tokens_saved=0):
+        with self.db:
+            self.db.execute(
+                "INSERT INTO units SELECT ?,?,?,?,?,?,?,?,?,?,?,? WHERE NOT EXISTS "
+                "(SELECT 1 FROM units WHERE run_id=? AND model=? AND question=? AND iteration=?)",
+                (run_id, model, question, iteration, warnings, errors, compile_seconds,
+                 completion.prompt_tokens, completion.output_tokens, completion.latency, time.time(), tokens_saved,
+                 run_id, model, question, iteration),
+            )
+
+    def add_score(self, run_id, model, entry):
+        with self.db:
+            self.db.execute(
+                "INSERT INTO scores SELECT ?,?,?,?,?,?,?,?,?,?,? WHERE NOT EXISTS "
+                "(SELECT 1 FROM scores WHERE run_id=? AND model=? AND iteration=?)",
+                (run_id, model, entry["Iteration"], entry["Unsuccessful compilation"], entry["warnings"],
+                 entry["compile_score"], entry["warninghandling_score"], entry["Total_score"],
+                 json.dumps(entry.get("stop_reasons", {})), json.dumps(entry.get("compile_seconds", {})), time.time(),
+                 run_id, model, entry["Iteration"]),
+            )
+
+    def best_per_model(self, last=100):
+        return self.db.execute(
+            "SELECT model, MAX(total_score), COUNT(DISTINCT run_id) FROM scores "
+            "WHERE run_id IN (SELECT run_id FROM runs GROUP BY run_id ORDER BY MAX(started_at) DESC LIMIT ?) "
+            "GROUP BY model ORDER BY MAX(total_score) DESC",
+            (last,),
+        ).fetchall()
+
+    def scores(self, run_id=None):
+        query = "SELECT run_id, model, iteration, unsuccessful, warnings, compile_score, warninghandling_score, total_score, stop_reasons, compile_seconds FROM scores"
+        rows = self.db.execute(query + (" WHERE run_id=?" if run_id else "") + " ORDER BY recorded_at", (run_id,) if run_id else ())
+        for run, model, iteration, unsuccessful, warnings, compile_score, warninghandling_score, total_score, stop_reasons, compile_seconds in rows:
+            yield {
+                "run_id": run,
+                "model": model,
+                "Iteration": iteration,
+                "Unsuccessful compilation": unsuccessful,
+                "warnings": warnings,
+                "compile_score": compile_score,
+                "warninghandling_score": warninghandling_score,
+                "Total_score": total_score,
+                "stop_reasons": json.loads(stop_reasons),
+                "compile_seconds": json.loads(compile_seconds),
+            }
+
+
+def merge(source, destination):
+    # Copy the rows of another store (e.g. a staged copy) into `destination`
+    # without overwriting anything written there in the meantime.
+    ResultsStore(source).db.close()
+    store = ResultsStore(destination)
+    db = store.db
+    db.execute("ATTACH DATABASE ? AS other", (source,))
+    with db:
+        db.execute(
+            "INSERT INTO runs (run_id, model, started_at, config, summary) "
+            "SELECT run_id, model, started_at, config, summary FROM other.runs WHERE true "
+            "ON CONFLICT (run_id, model) DO UPDATE SET summary=excluded.summary WHERE excluded.summary IS NOT NULL"
+        )
+        units = "run_id, model, question, iteration, warnings, errors, compile_seconds, prompt_tokens, output_tokens, latency, recorded_at, tokens_saved"
+        db.execute(
+            f"INSERT INTO units ({units}) SELECT {units} FROM other.units o WHERE NOT EXISTS "
+            "(SELECT 1 FROM units u WHERE u.run_id=o.run_id AND u.model=o.model AND u.question=o.question AND u.iteration=o.iteration)"
+        )
+        scores = ("run_id, model, iteration, unsuccessful, warnings, compile_score, warninghandling_score, total_score, "
+                  "stop_reasons, compile_seconds, recorded_at")
+        db.execute(
+            f"INSERT INTO scores ({scores}) SELECT {scores} FROM other.scores o WHERE NOT EXISTS "
+            "(SELECT 1 FROM scores s WHERE s.run_id=o.run_id AND s.model=o.model AND s.iteration=o.iteration)"
+        )
+    db.execute("DETACH DATABASE other")
+    db.close()
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Query the evaluation results store")
+    parser.add_argument("--db", default=RESULTS_DB)
+    commands = parser.add_subparsers(dest="command", required=True)
+    best = commands.add_parser("best", help="best total_score per model over the most recent runs")
+    best.add_argument("--last", type=int, default=100)
+    export = commands.add_parser("export-yaml", help="write scores in the old scores.yaml layout")
+    export.add_argument("path")
+    export.add_argument("--run", default=None)
+    args = parser.parse_args()
+
+    store = ResultsStore(args.db)
+    if args.command == "best":
+        for model, score, runs in store.best_per_model(args.last):
+            print(f"{model}: {score:.3f} (over {runs} runs)")
+    else:
+        with open(args.path, 'w') as f:
+            yaml.dump(list(store.scores(args.run)), f, default_flow_style=False)
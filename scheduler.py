@@ -0,0 +1,117 @@
+import time
+
+
+class Budget:
+    def __init__(self, tokens=None, wall_clock_seconds=None, cost_usd=None,
+                 usd_per_million_input_tokens=0.0, usd_per_million_output_tokens=0.0):
+        self.tokens = tokens
+        self.wall_clock_seconds = wall_clock_seconds
+        self.cost_usd = cost_usd
+        self.input_price = usd_per_million_input_tokens / 1e6
+        self.output_price = usd_per_million_output_tokens / 1e6
+        self.started = time.monotonic()
+        self.spent_tokens = 0
+        self.spent_usd = 0.0
+
+    @classmethod
+    def from_config(cls, config):
+        return cls(**config)
+
+    def charge(self, completion):
+        self.spent_tokens += completion.prompt_tokens + completion.output_tokens
+        self.spent_usd += completion.prompt_tokens * self.input_price + completion.output_tokens * self.output_price
+
+    def exhausted(self):
+        if self.tokens is not None and self.spent_tokens >= self.tokens:
+            return "token_budget"
+        if self.cost_usd is not None and self.spent_usd >= self.cost_usd:
+            return "cost_budget"
+        if self.wall_clock_seconds is not None and time.monotonic() - self.started >= self.wall_clock_seconds:
+            return "time_budget"
+        return None
+
+
+class QuestionState:
+    def __init__(self, index):
+        self.index = index
+        self.iterations = 0
+        self.warnings = 0
+        self.errors = 0
+        self.best = None
+        self.stale = 0
+        self.stop_reason = None
+
+
+class Scheduler:
+    # Runs questions in rounds. A question retires once it converges (no
+    # errors or warnings) or plateaus (no improvement for `patience`
+    # iterations); the iterations it did not use go to a shared pool that
+    # questions still failing can draw from, up to `max_iterations` each.
+    def __init__(self, count, iterations=5, max_iterations=None, patience=2, budget=None):
+        self.states = [QuestionState(j) for j in range(count)]
+        self.iterations = iterations
+        self.max_iterations = max_iterations or iterations
+        self.patience = patience
+        self.budget = budget or Budget()
+        self.pool = 0
+
+    def _retire(self, state, reason):
+        state.stop_reason = reason
+        self.pool += max(0, self.iterations - state.iterations)
+
+    def settle(self):
+        # Called after each round so the score output already carries the
+        # stop reason of every question that cannot run again.
+        active = [state for state in self.states if state.stop_reason is None]
+        reason = self.budget.exhausted()
+        # Only questions still inside their base iterations can return
+        # iterations to the pool, so without them an empty pool is final.
+        starved = self.pool == 0 and not any(state.iterations < self.iterations for state in active)
+        for state in active:
+            if reason:
+                state.stop_reason = reason
+            elif state.iterations >= self.max_iterations or (starved and state.iterations >= self.iterations):
+                state.stop_reason = "iterations"
+
+    def next_round(self):
+        self.settle()
+        active = [state for state in self.states if state.stop_reason is None]
+        scheduled = [state for state in active if state.iterations < self.iterations]
+        extra = [state for state in active if state.iterations >= self.iterations]
+        extra.sort(key=lambda state: (state.errors, state.warnings), reverse=True)
+        scheduled += extra[:self.pool]
+        self.pool -= len(extra[:self.pool])
+        return [state.index for state in scheduled]
+
+    def iteration(self, index):
+        return self.states[index].iterations
+
+    def record(self, index, warnings, errors, completion):
+        state = self.states[index]
+        state.iterations += 1
+        state.warnings = warnings
+        state.errors = errors
+        self.budget.charge(completion)
+
+        if errors == 0 and warnings == 0:
+            self._retire(state, "converged")
+            return
+        if state.best is None or (errors, warnings) < state.best:
+            state.best = (errors, warnings)
+            state.stale = 0
+        else:
+            state.stale += 1
+            if self.patience and state.stale >= self.patience:
+                self._retire(state, "plateau")
+
+    def snapshot(self):
+        return {"pool": self.pool, "states": [dict(vars(state)) for state in self.states]}
+
+    def restore(self, snapshot):
+        self.pool = snapshot["pool"]
+        for state, saved in zip(self.states, snapshot["states"]):
+            vars(state).update(saved)
+            state.best = tuple(state.best) if state.best is not None else None
+
+    def stop_reasons(self):
+        return {state.index: state.stop_reason for state in self.states if state.stop_reason}
@@ -0,0 +1,80 @@
+import fcntl
+import hashlib
+import os
+import shutil
+import sqlite3
+
+import results
+
+
+STAGING_ROOT = "/dev/shm/llm-evaluator"
+
+# Inputs copied into the staging directory before a run.
+WORKING_SET = ["config.json", "compile_commands.json", ".clang-tidy", "Makefile", "ldd.c"]
+# Outputs copied back to the original directory after it; main.py adds the
+# configured trace directory.
+ARTIFACTS = ["temp_ldd", "fixes"]
+
+# Held for the whole run, so two runs never share one staging directory.
+_lock = None
+
+
+def _copy_db(source, destination):
+    # The backup API gives a consistent copy even of a database in WAL mode.
+    if not os.path.exists(source):
+        return
+    src = sqlite3.connect(source)
+    dst = sqlite3.connect(destination)
+    with dst:
+        src.backup(dst)
+    src.close()
+    dst.close()
+
+
+def staging_dir(origin, root=STAGING_ROOT):
+    # One directory per checkout: runs from different checkouts never share
+    # work/ or a database, and each keeps its own warm cache.
+    origin = os.path.realpath(origin)
+    digest = hashlib.sha256(origin.encode()).hexdigest()[:12]
+    return os.path.join(root, f"{os.path.basename(origin)}-{digest}")
+
+
+def check_path(name, path):
+    # Databases are staged by their path relative to the run directory; an
+    # absolute or outside path would be shared with, or copied onto, itself.
+    if os.path.isabs(path) or os.path.normpath(path).startswith(".."):
+        raise ValueError(f'with staging enabled, "{name}" must be a relative path inside the run directory, not {path}')
+
+
+def stage(origin, root=STAGING_ROOT, databases=()):
+    # Mirror the working set into tmpfs. The staging directory is kept
+    # between runs, so the analysis cache and PCHs under .cache/ stay warm
+    # until the next reboot.
+    global _lock
+    directory = staging_dir(origin, root)
+    os.makedirs(directory, exist_ok=True)
+    _lock = open(os.path.join(directory, ".lock"), 'w')
+    try:
+        fcntl.flock(_lock, fcntl.LOCK_EX | fcntl.LOCK_NB)
+    except BlockingIOError:
+        raise RuntimeError(f"another run from {origin} is already using {directory}") from None
+    for name in WORKING_SET:
+        source = os.path.join(origin, name)
+        if os.path.exists(source):
+            shutil.copy2(source, os.path.join(directory, name))
+    for name in databases:
+        _copy_db(os.path.join(origin, name), os.path.join(directory, name))
+    return directory
+
+
+def sync_back(root, origin, databases=(), artifacts=ARTIFACTS):
+    # One pass at the end of the run instead of a slow shared-folder write
+    # for every generated file. Result rows are merged, so rows another run
+    # wrote to the original database in the meantime are kept.
+    for name in artifacts:
+        source = os.path.join(root, name)
+        if os.path.isdir(source):
+            shutil.copytree(source, os.path.join(origin, name), dirs_exist_ok=True)
+    for name in databases:
+        if os.path.exists(os.path.join(root, name)):
+            results.merge(os.path.join(root, name), os.path.join(origin, name))
@@ -0,0 +1,28 @@
+import unittest
+
+from patching import PatchError, apply_unified
+
+
+SOURCE = "int a;\n-- x\nint b;\n"
+
+
+class ApplyUnifiedTest(unittest.TestCase):
+    def test_file_headers_are_skipped(self):
+        diff = "--- a/ldd.c\n+++ b/ldd.c\n@@ -1,3 +1,3 @@\n int a;\n--- x\n+int c;\n int b;\n"
+        self.assertEqual(apply_unified(SOURCE, diff), "int a;\nint c;\nint b;\n")
+
+    def test_first_line_removes_double_dash(self):
+        diff = "@@ -2,2 +2,2 @@\n--- x\n+int c;\n int b;\n"
+        self.assertEqual(apply_unified(SOURCE, diff), "int a;\nint c;\nint b;\n")
+
+    def test_first_line_adds_double_plus(self):
+        diff = "@@ -1,1 +1,2 @@\n+++x;\n int a;\n"
+        self.assertEqual(apply_unified(SOURCE, diff), "++x;\nint a;\n-- x\nint b;\n")
+
+    def test_unmatched_hunk_is_rejected(self):
+        with self.assertRaises(PatchError):
+            apply_unified(SOURCE, "@@ -2,1 +2,1 @@\n--- y\n+int c;\n")
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,232 @@
+import hashlib
+import json
+import os
+import re
+import shutil
+import subprocess
+import tempfile
+import threading
+from collections import OrderedDict
+from concurrent.futures import ThreadPoolExecutor
+
+import depfile
+
+
+CACHE_DIR = ".cache/tidy"
+PLACEHOLDER = "@WORKSPACE@"
+TREE = "@TREE@"
+KDIR = "@KDIR@"
+KDIR_PATH = re.compile(r"/lib/modules/[^/]+/build")
+
+
+def normalize_source(code):
+    # Trailing whitespace and line endings never change a diagnostic's
+    # line:column, so they are dropped before the code is written and hashed.
+    lines = [line.rstrip() for line in code.replace("\r\n", "\n").split("\n")]
+    return "\n".join(lines).rstrip("\n") + "\n"
+
+
+def header_tree(arguments):
+    # The kernel tree is the shortest "-I<root>/include" prefix; the others are
+    # arch/ and uapi/ subdirectories of it.
+    roots = [m.group(1) for m in (re.match(r"^-I(.*)/include$", arg) for arg in arguments) if m]
+    return min(roots, key=len) if roots else None
+
+
+def header_tree_version(root):
+    if root is None:
+        return ""
+    parts = [root]
+    for name in ("include/generated/utsrelease.h", "include/generated/autoconf.h"):
+        path = os.path.join(root, name)
+        if os.path.exists(path):
+            with open(path, 'rb') as f:
+                parts.append(hashlib.sha256(f.read()).hexdigest())
+    return "\n".join(parts)
+
+
+def tool_version(tool="clang-tidy"):
+    try:
+        return subprocess.run([tool, "--version"], stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True, check=False).stdout
+    except FileNotFoundError:
+        return ""
+
+
+class TidyCache:
+    # Content-addressed store of analysis results. "tidy" entries hold the
+    # clang-tidy output and exported fixes; "kbuild" entries hold the kernel
+    # build log and status. Entries are shared by every workspace and model.
+    #
+    # The key covers the source, config and flags with the kernel tree's path
+    # replaced by a placeholder. Under each key, every stored result records
+    # the headers the driver included (from its depfile) with their size,
+    # mtime and hash, and is served only while those headers are unchanged.
+    # A new kernel header package therefore invalidates only the drivers whose
+    # headers actually differ, not the whole cache.
+    def __init__(self, root=CACHE_DIR, config=".clang-tidy", makefile="Makefile"):
+        self.root = root
+        self.hits = 0
+        self.misses = 0
+        with open(config, 'rb') as f:
+            self.config = f.read()
+        with open(makefile, 'rb') as f:
+            self.makefile = f.read()
+        self.tool = tool_version()
+        self.trees = {}
+        self.hashes = {}
+        self.lock = threading.Lock()
+        self.scans = OrderedDict()
+        # Depfile scans start on a miss, so they overlap the analysis itself.
+        self.pool = ThreadPoolExecutor(max(4, os.cpu_count() or 1))
+
+    def _tree_version(self, root):
+        if root not in self.trees:
+            self.trees[root] = header_tree_version(root)
+        return self.trees[root]
+
+    def _roots(self, ws):
+        with open(ws.compile_db, 'r') as f:
+            arguments = json.load(f)[0]["arguments"]
+        return arguments, header_tree(arguments)
+
+    def _normalize(self, text, ws, tree):
+        text = text.replace(ws.dir, PLACEHOLDER)
+        if tree:
+            text = text.replace(tree, TREE)
+        return text
+
+    def _resolve(self, path, ws, tree):
+        return path.replace(PLACEHOLDER, ws.dir).replace(TREE, tree or TREE)
+
+    def key(self, ws, extra_args, kind="tidy", scope=""):
+        # `scope` separates results whose compile database does not describe
+        # the tree they were built against, e.g. a kernel tree without one.
+        arguments, tree = self._roots(ws)
+        flags = [self._normalize(arg, ws, tree) for arg in arguments]
+        # The include path the caller adds names the running kernel release.
+        extra = [KDIR_PATH.sub(KDIR, self._normalize(arg, ws, tree)) for arg in extra_args]
+
+        if kind == "kbuild":
+            inputs = (self.makefile, json.dumps(flags).encode(), scope.encode())
+        else:
+            inputs = (self.config, json.dumps(flags).encode(), json.dumps(extra).encode(), self.tool.encode())
+
+        digest = hashlib.sha256(kind.encode())
+        for part in (normalize_source(ws.read_source()).encode(),) + inputs:
+            digest.update(hashlib.sha256(part).digest())
+        return f"{kind}/{digest.hexdigest()}"
+
+    def _path(self, key):
+        kind, digest = key.split("/")
+        return os.path.join(self.root, kind, digest[:2], digest)
+
+    def _scan(self, ws):
+        # One preprocessor run per source, shared by its tidy and kbuild entries.
+        token = (ws.compile_db, hashlib.sha256(ws.read_source().encode()).hexdigest())
+        with self.lock:
+            if token not in self.scans:
+                self.scans[token] = self.pool.submit(depfile.scan, ws.compile_db)
+                while len(self.scans) > 256:
+                    self.scans.popitem(last=False)
+            return self.scans[token]
+
+    def _hash(self, path, stat):
+        token = (path, stat.st_size, stat.st_mtime_ns)
+        if token not in self.hashes:
+            with open(path, 'rb') as f:
+                self.hashes[token] = hashlib.sha256(f.read()).hexdigest()
+        return self.hashes[token]
+
+    def _fingerprint(self, path):
+        try:
+            stat = os.stat(path)
+        except OSError:
+            return None
+        return [stat.st_size, stat.st_mtime_ns, self._hash(path, stat)]
+
+    def _valid(self, deps, ws, tree):
+        if "tree" in deps and deps["tree"] != self._tree_version(tree):
+            return False
+        for path, recorded in deps["files"]:
+            path = self._resolve(path, ws, tree)
+            try:
+                stat = os.stat(path)
+            except OSError:
+                if recorded is None:
+                    continue
+                return False
+            if recorded is None or stat.st_size != recorded[0]:
+                return False
+            # mtime and size are enough while nothing touched the header; a
+            # reinstalled or new tree with identical content needs the hash.
+            if stat.st_mtime_ns != recorded[1] and self._hash(path, stat) != recorded[2]:
+                return False
+        return True
+
+    def lookup(self, key, ws, files=None):
+        base = self._path(key)
+        _, tree = self._roots(ws)
+        variants = sorted(os.listdir(base)) if os.path.isdir(base) else []
+        for variant in variants:
+            path = os.path.join(base, variant)
+            if variant.startswith(".") or not os.path.exists(os.path.join(path, "deps.json")):
+                continue
+            with open(os.path.join(path, "deps.json"), 'r') as f:
+                if not self._valid(json.load(f), ws, tree):
+                    continue
+            with open(os.path.join(path, "output.txt"), 'r') as f:
+                text = f.read().replace(PLACEHOLDER, ws.dir)
+            for name, destination in (files or {}).items():
+                if os.path.exists(os.path.join(path, name)):
+                    with open(os.path.join(path, name), 'r') as f:
+                        content = f.read().replace(PLACEHOLDER, ws.dir)
+                    with open(destination, 'w') as f:
+                        f.write(content)
+            with open(os.path.join(path, "meta.json"), 'r') as f:
+                meta = json.load(f)
+            self.hits += 1
+            return text, meta
+        self.misses += 1
+        self._scan(ws)
+        return None
+
+    def dependencies(self, ws, extra=()):
+        _, tree = self._roots(ws)
+        paths = self._scan(ws).result()
+        if paths is None:
+            # No depfile (the preprocessor failed): fall back to the whole tree.
+            return {"tree": self._tree_version(tree), "files": []}
+        files = [[self._normalize(path, ws, tree), self._fingerprint(path)]
+                 for path in sorted(set(paths) | set(extra))]
+        return {"files": files}
+
+    def signature(self, key, ws, extra_deps=()):
+        # Equal for two workspaces, e.g. in different kernel trees, whose
+        # results are interchangeable: same key and identical header contents.
+        deps = self.dependencies(ws, extra_deps)
+        files = [[path, recorded and recorded[2]] for path, recorded in deps["files"]]
+        return hashlib.sha256(json.dumps([key, deps.get("tree"), files]).encode()).hexdigest()
+
+    def store(self, key, ws, text, files=None, meta=None, extra_deps=()):
+        base = self._path(key)
+        deps = self.dependencies(ws, extra_deps)
+        path = os.path.join(base, hashlib.sha256(json.dumps(deps).encode()).hexdigest()[:16])
+        os.makedirs(base, exist_ok=True)
+        staging = tempfile.mkdtemp(dir=base, prefix=".")
+        with open(os.path.join(staging, "output.txt"), 'w') as f:
+            f.write(text.replace(ws.dir, PLACEHOLDER))
+        for name, source in (files or {}).items():
+            if os.path.exists(source):
+                with open(source, 'r') as f:
+                    content = f.read().replace(ws.dir, PLACEHOLDER)
+                with open(os.path.join(staging, name), 'w') as f:
+                    f.write(content)
+        with open(os.path.join(staging, "meta.json"), 'w') as f:
+            json.dump(meta or {}, f)
+        with open(os.path.join(staging, "deps.json"), 'w') as f:
+            json.dump(deps, f)
+        try:
+            os.rename(staging, path)
+        except OSError:
+            # Another worker stored the same key first.
+            shutil.rmtree(staging, ignore_errors=True)
@@ -0,0 +1,145 @@
+import argparse
+import glob
+import json
+import os
+import re
+import shutil
+import tempfile
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+import yaml
+
+import diagnostics
+from analysis_server import run_clang_tidy
+from workspace import Workspace
+
+
+# Profiles clang-tidy per check over a corpus of drivers: the time each check
+# takes (--enable-check-profile) next to the diagnostics it produces. Checks
+# that are expensive and find nothing on kernel drivers can then be turned
+# off in a tuned copy of .clang-tidy, and the gain measured.
+
+PROFILE_KEY = re.compile(r"^time\.clang-tidy\.(?P<check>.+)\.(?P<kind>wall|user|sys)$")
+EXTRA_ARGS = [f"--extra-arg=-I/lib/modules/{os.uname().release}/build/include"]
+
+
+def workspaces(corpus, root):
+    for n, path in enumerate(corpus):
+        ws = Workspace(n, root=root, name=f"p{n}").prepare()
+        with open(path, 'r') as f:
+            ws.write_source(f.read())
+        yield ws
+
+
+def analyze(ws, options):
+    return run_clang_tidy(ws.source, ws.dir, ws.fixes, EXTRA_ARGS + options)
+
+
+def profile(corpus, root, workers, config):
+    # One profile JSON per translation unit ends up in the workspace's
+    # profile directory; sum them per check. The workspaces live outside the
+    # repository, so the config is passed explicitly: clang-tidy would not
+    # find .clang-tidy by searching upwards from them.
+    seconds, hits, files = {}, {}, {}
+    spaces = list(workspaces(corpus, root))
+
+    def run(ws):
+        store = os.path.join(ws.dir, "profile")
+        shutil.rmtree(store, ignore_errors=True)
+        output = analyze(ws, [f"--config-file={config}", "--enable-check-profile", f"--store-check-profile={store}"])
+        return ws, store, output
+
+    with ThreadPoolExecutor(workers) as pool:
+        for ws, store, output in pool.map(run, spaces):
+            for path in glob.glob(os.path.join(store, "*.json")):
+                with open(path, 'r') as f:
+                    for key, value in json.load(f).get("profile", {}).items():
+                        match = PROFILE_KEY.match(key)
+                        if match and match["kind"] == "wall":
+                            seconds[match["check"]] = seconds.get(match["check"], 0.0) + value
+            fired = set()
+            for record in diagnostics.dedupe(diagnostics.parse(output.splitlines())):
+                if record.check:
+                    hits[record.check] = hits.get(record.check, 0) + 1
+                    fired.add(record.check)
+            for check in fired:
+                files[check] = files.get(check, 0) + 1
+    return {
+        check: {"seconds": seconds.get(check, 0.0), "diagnostics": hits.get(check, 0), "files": files.get(check, 0)}
+        for check in set(seconds) | set(hits)
+    }
+
+
+def measure(corpus, root, workers, config):
+    options = [f"--config-file={config}"]
+    spaces = list(workspaces(corpus, root))
+    start = time.monotonic()
+    with ThreadPoolExecutor(workers) as pool:
+        list(pool.map(lambda ws: analyze(ws, options), spaces))
+    return time.monotonic() - start
+
+
+def candidates(report, min_share, noisy):
+    # A check is worth disabling when it costs at least `min_share` of the
+    # total check time and found nothing. Checks listed as noisy are always
+    # disabled, however cheap, and whether or not the profile lists them.
+    total = sum(row["seconds"] for row in report.values()) or 1.0
+    quiet = {check for check, row in report.items() if row["seconds"] / total >= min_share and row["diagnostics"] == 0}
+    return sorted(quiet | set(noisy))
+
+
+def tuned_config(path, disabled):
+    with open(path, 'r') as f:
+        config = yaml.safe_load(f)
+    checks = [check.strip() for check in config.get("Checks", "").split(",") if check.strip()]
+    config["Checks"] = ",".join(checks + [f"-{check}" for check in disabled])
+    return config
+
+
+def print_report(report, corpus):
+    total = sum(row["seconds"] for row in report.values()) or 1.0
+    header = f"{'check':<64}{'seconds':>10}{'share':>8}{'diags':>7}{'files':>7}"
+    print(header)
+    print("-" * len(header))
+    for check, row in sorted(report.items(), key=lambda item: item[1]["seconds"], reverse=True):
+        print(f"{check:<64}{row['seconds']:>10.3f}{row['seconds'] / total:>8.1%}{row['diagnostics']:>7}{row['files']:>4}/{len(corpus)}")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Profile clang-tidy checks over a driver corpus and tune .clang-tidy")
+    parser.add_argument("--config", default=".clang-tidy")
+    parser.add_argument("--workers", type=int, default=os.cpu_count())
+    parser.add_argument("--min-share", type=float, default=0.02, help="smallest share of check time worth disabling")
+    parser.add_argument("--noisy", action="append", default=[],
+                        help="check whose diagnostics are not useful on kernel drivers (repeatable), "
+                             "e.g. bugprone-easily-swappable-parameters")
+    parser.add_argument("--write", metavar="PATH", help="write a tuned .clang-tidy here")
+    parser.add_argument("--measure", action="store_true", help="time the corpus with the original and tuned configs (needs --write)")
+    parser.add_argument("--json", metavar="PATH", help="also write the per-check report as JSON")
+    parser.add_argument("corpus", nargs="*", help="drivers to profile (default: temp_ldd/*.c and ldd.c)")
+    args = parser.parse_args()
+    if args.measure and not args.write:
+        parser.error("--measure times the tuned config, so it needs --write")
+
+    corpus = args.corpus or sorted(glob.glob("temp_ldd/*.c")) + ["ldd.c"]
+    root = tempfile.mkdtemp(prefix="tidy-profile-")
+    try:
+        report = profile(corpus, root, args.workers, os.path.abspath(args.config))
+        print_report(report, corpus)
+        if args.json:
+            with open(args.json, 'w') as f:
+                json.dump(report, f, indent=2)
+
+        disabled = candidates(report, args.min_share, set(args.noisy))
+        print(f"\n{len(disabled)} checks to disable: {', '.join(disabled) or 'none'}")
+        if args.write:
+            with open(args.write, 'w') as f:
+                yaml.safe_dump(tuned_config(args.config, disabled), f, sort_keys=False)
+            print(f"Tuned config written to {args.write}")
+        if args.measure:
+            before = measure(corpus, root, args.workers, os.path.abspath(args.config))
+            after = measure(corpus, root, args.workers, os.path.abspath(args.write))
+            print(f"Corpus analysis: {before:.2f}s before, {after:.2f}s after ({before / after:.2f}x)")
+    finally:
+        shutil.rmtree(root, ignore_errors=True)
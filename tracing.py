@@ -0,0 +1,100 @@
+import contextvars
+import json
+import os
+import threading
+import time
+from contextlib import contextmanager
+
+from llm import percentile
+
+
+_tags = contextvars.ContextVar("trace_tags", default={})
+
+
+def tag(**tags):
+    # Tags apply to every span opened afterwards in the current task, and in
+    # the threads it starts with asyncio.to_thread, which copy the context.
+    _tags.set({**_tags.get(), **tags})
+
+
+class Tracer:
+    # Collects one complete span per stage (prompt build, LLM call, analysis,
+    # scoring, ...) tagged with model, question and iteration, and exports
+    # them as Chrome trace-event JSON (chrome://tracing or ui.perfetto.dev).
+    def __init__(self, enabled=True):
+        self.enabled = enabled
+        self.origin = time.perf_counter()
+        self.spans = []
+        self.lock = threading.Lock()
+
+    @contextmanager
+    def span(self, name, lane="", **args):
+        # The yielded dict can be filled in while the span is open, e.g.
+        # with token counts once the response arrives. Spans that overlap
+        # within one question (clang-tidy and kbuild) go on separate lanes.
+        if not self.enabled:
+            yield args
+            return
+        start = time.perf_counter()
+        try:
+            yield args
+        finally:
+            end = time.perf_counter()
+            with self.lock:
+                self.spans.append((name, lane, start, end, {**_tags.get(), **args}))
+
+    def summary(self, model=None):
+        durations = {}
+        for name, _, start, end, tags in self.spans:
+            if model is None or tags.get("model") == model:
+                durations.setdefault(name, []).append(end - start)
+        return {
+            name: {
+                "count": len(values),
+                "total": sum(values),
+                "p50": percentile(values, 0.50),
+                "p95": percentile(values, 0.95),
+                "p99": percentile(values, 0.99),
+            }
+            for name, values in durations.items()
+        }
+
+    def export(self, path):
+        # One process per model and one thread per question (and candidate),
+        # so the viewer shows each question's stages on its own row.
+        processes, threads, events = {}, {}, []
+        for name, lane, start, end, tags in self.spans:
+            process = tags.get("model", "main")
+            pid = processes.setdefault(process, len(processes) + 1)
+            thread = "scoring" if "question" not in tags else f"q{tags['question']}"
+            if "candidate" in tags:
+                thread += f"/candidate{tags['candidate']}"
+            if lane:
+                thread += f" {lane}"
+            tid = threads.setdefault((pid, thread), len(threads) + 1)
+            events.append({
+                "name": name,
+                "cat": "stage",
+                "ph": "X",
+                "ts": round((start - self.origin) * 1e6, 1),
+                "dur": round((end - start) * 1e6, 1),
+                "pid": pid,
+                "tid": tid,
+                "args": tags,
+            })
+        for process, pid in processes.items():
+            events.append({"name": "process_name", "ph": "M", "pid": pid, "args": {"name": process}})
+        for (pid, thread), tid in threads.items():
+            events.append({"name": "thread_name", "ph": "M", "pid": pid, "tid": tid, "args": {"name": thread}})
+
+        os.makedirs(os.path.dirname(path) or ".", exist_ok=True)
+        with open(path, 'w') as f:
+            json.dump({"traceEvents": events, "displayTimeUnit": "ms"}, f)
+
+
+def print_summary(summary):
+    header = f"{'stage':<16}{'count':>7}{'total':>10}{'p50':>10}{'p95':>10}{'p99':>10}"
+    print(header)
+    print("-" * len(header))
+    for name, row in sorted(summary.items(), key=lambda item: item[1]["total"], reverse=True):
+        print(f"{name:<16}{row['count']:>7}{row['total']:>9.2f}s{row['p50']:>9.3f}s{row['p95']:>9.3f}s{row['p99']:>9.3f}s")
@@ -0,0 +1,254 @@
+import argparse
+import json
+import os
+import socket
+import sqlite3
+import shutil
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+import kbuild
+from analysis_server import AnalysisClient, SOCKET_PATH, run_tiers
+from workspace import Workspace
+
+
+QUEUE_DB = ".cache/queue.db"
+
+SCHEMA = """
+CREATE TABLE IF NOT EXISTS jobs (
+    id INTEGER PRIMARY KEY AUTOINCREMENT,
+    campaign TEXT,
+    kind TEXT,
+    payload TEXT,
+    state TEXT DEFAULT 'pending',
+    worker TEXT,
+    lease_until REAL,
+    attempts INTEGER DEFAULT 0,
+    result TEXT,
+    error TEXT,
+    submitted_at REAL,
+    finished_at REAL
+);
+CREATE INDEX IF NOT EXISTS jobs_state ON jobs (state, id);
+CREATE INDEX IF NOT EXISTS jobs_campaign ON jobs (campaign, state);
+"""
+
+
+def connect(path):
+    os.makedirs(os.path.dirname(os.path.abspath(path)), exist_ok=True)
+    db = sqlite3.connect(path, timeout=60, isolation_level=None)
+    db.executescript(SCHEMA)
+    return db
+
+
+class WorkQueue:
+    # Analysis jobs (clang-tidy and kbuild) in a SQLite table that any number
+    # of worker processes poll. Workers pull the oldest pending job whenever
+    # they are idle, so a slow clang-analyzer run never holds up jobs queued
+    # behind it, and a job whose worker died is taken over once its lease
+    # runs out. Single host only: SQLite's locking is not reliable on network
+    # or shared filesystems such as vboxsf, so claims could collide there.
+    def __init__(self, path=QUEUE_DB, campaign="", poll_seconds=0.05, max_poll_seconds=0.5):
+        self.path = path
+        self.campaign = campaign
+        self.poll = poll_seconds
+        self.max_poll = max_poll_seconds
+        # Worker processes started for this queue (see spawn); once all of
+        # them have exited, nobody is left to run a waiting job.
+        self.workers = []
+        self.local = threading.local()
+        connect(path).close()
+
+    @property
+    def db(self):
+        # sqlite3 connections must stay on the thread that opened them.
+        if not hasattr(self.local, "db"):
+            self.local.db = connect(self.path)
+        return self.local.db
+
+    def submit(self, kind, payload):
+        cursor = self.db.execute(
+            "INSERT INTO jobs (campaign, kind, payload, submitted_at) VALUES (?,?,?,?)",
+            (self.campaign, kind, json.dumps(payload), time.time()),
+        )
+        return cursor.lastrowid
+
+    def wait(self, job):
+        delay = self.poll
+        while True:
+            state, worker, result, error = self.db.execute(
+                "SELECT state, worker, result, error FROM jobs WHERE id=?", (job,)
+            ).fetchone()
+            if state == "done":
+                return json.loads(result)
+            if state == "failed":
+                raise RuntimeError(f"analysis job {job} failed on {worker}: {error}")
+            if self.workers and all(child.poll() is not None for child in self.workers):
+                error = "every worker process has exited"
+                self.db.execute("UPDATE jobs SET state='failed', error=?, finished_at=? WHERE id=? AND state IN ('pending', 'running')",
+                                (error, time.time(), job))
+                raise RuntimeError(f"analysis job {job} failed: {error}")
+            time.sleep(delay)
+            delay = min(self.max_poll, delay * 2)
+
+    def run(self, kind, payload):
+        return self.wait(self.submit(kind, payload))
+
+    def purge(self):
+        self.db.execute("DELETE FROM jobs WHERE campaign=? AND state IN ('done', 'failed')", (self.campaign,))
+
+
+def claim(db, worker, lease_seconds):
+    # BEGIN IMMEDIATE takes the write lock up front, so two workers can never
+    # claim the same job. The returned attempt number is the claim's fencing
+    # token: a worker whose lease was taken over can no longer finish the job.
+    now = time.time()
+    db.execute("BEGIN IMMEDIATE")
+    try:
+        row = db.execute(
+            "SELECT id, kind, payload, attempts + 1 FROM jobs WHERE state='pending' OR (state='running' AND lease_until<?) "
+            "ORDER BY id LIMIT 1",
+            (now,),
+        ).fetchone()
+        if row:
+            db.execute(
+                "UPDATE jobs SET state='running', worker=?, lease_until=?, attempts=attempts+1 WHERE id=?",
+                (worker, now + lease_seconds, row[0]),
+            )
+        db.execute("COMMIT")
+    except BaseException:
+        db.execute("ROLLBACK")
+        raise
+    return row
+
+
+def heartbeat(path, job, token, lease_seconds, stop):
+    # Keeps the lease of a long job alive, so it is not taken over while
+    # this worker is still running it.
+    db = connect(path)
+    while not stop.wait(lease_seconds / 3):
+        db.execute("UPDATE jobs SET lease_until=? WHERE id=? AND attempts=? AND state='running'",
+                   (time.time() + lease_seconds, job, token))
+    db.close()
+
+
+def finish(db, job, token, state, column, value, files):
+    # Results and workspace files are written only while the claim is still
+    # current; a stale worker's output is dropped.
+    db.execute("BEGIN IMMEDIATE")
+    try:
+        current = db.execute("SELECT 1 FROM jobs WHERE id=? AND attempts=? AND state='running'", (job, token)).fetchone()
+        if current:
+            for destination, source in files.items():
+                if os.path.exists(source):
+                    shutil.copyfile(source, destination)
+                elif os.path.exists(destination):
+                    os.remove(destination)
+            db.execute(f"UPDATE jobs SET state=?, {column}=?, finished_at=? WHERE id=?", (state, value, time.time(), job))
+        db.execute("COMMIT")
+    except BaseException:
+        db.execute("ROLLBACK")
+        raise
+
+
+def execute(kind, payload, server, scratch):
+    # Jobs write into `scratch`; returns the result and the workspace files
+    # to copy in from there.
+    if kind == "tidy":
+        fixes = os.path.join(scratch, os.path.basename(payload["fixes"]))
+        args = (payload["source"], payload["build_dir"], fixes, payload["extra_args"])
+        if server:
+            output, tier = server.diagnose(*args, payload["gate"])
+        else:
+            output, tier = run_tiers(*args, gate=payload["gate"])
+        return {"output": output, "tier": tier}, {payload["fixes"]: fixes}
+    if kind == "kbuild":
+        directory = payload["dir"]
+        ws = Workspace(0, root=os.path.dirname(directory), name=os.path.basename(directory))
+        private = Workspace(0, root=scratch, name="build")
+        os.makedirs(private.dir)
+        shutil.copyfile(ws.source, private.source)
+        shutil.copyfile(os.path.join(ws.dir, "Makefile"), os.path.join(private.dir, "Makefile"))
+        output, built, seconds = kbuild.build_module(private, payload["kdir"])
+        output = output.replace(private.dir, ws.dir)
+        with open(private.build_log, 'w') as f:
+            f.write(output)
+        return {"output": output, "built": built, "seconds": seconds}, {ws.build_log: private.build_log}
+    raise ValueError(f"unknown job kind {kind!r}")
+
+
+def work(path, lease_seconds=600, idle_exit=None, analysis_socket=SOCKET_PATH):
+    db = connect(path)
+    worker = f"{socket.gethostname()}:{os.getpid()}"
+    server = AnalysisClient(analysis_socket)
+    server = server if server.available() else None
+    idle_since = time.monotonic()
+    delay = 0.05
+    while True:
+        job = claim(db, worker, lease_seconds)
+        if job is None:
+            if idle_exit is not None and time.monotonic() - idle_since > idle_exit:
+                return
+            time.sleep(delay)
+            delay = min(0.5, delay * 2)
+            continue
+        job_id, kind, payload, token = job
+        stop = threading.Event()
+        threading.Thread(target=heartbeat, args=(path, job_id, token, lease_seconds, stop), daemon=True).start()
+        scratch = tempfile.mkdtemp(prefix=f"job-{job_id}-")
+        try:
+            result, files = execute(kind, json.loads(payload), server, scratch)
+            finish(db, job_id, token, "done", "result", json.dumps(result), files)
+        except Exception as exc:
+            finish(db, job_id, token, "failed", "error", repr(exc), {})
+        finally:
+            stop.set()
+            shutil.rmtree(scratch, ignore_errors=True)
+        idle_since = time.monotonic()
+        delay = 0.05
+
+
+def spawn(path, count, options=()):
+    # Single-process workers, e.g. the local ones main.py starts and stops.
+    return [
+        subprocess.Popen([sys.executable, os.path.abspath(__file__), "--db", path, "worker", *options])
+        for _ in range(count)
+    ]
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="SQLite-backed analysis work queue")
+    parser.add_argument("--db", default=QUEUE_DB)
+    commands = parser.add_subparsers(dest="command", required=True)
+    worker = commands.add_parser("worker", help="run analysis jobs until interrupted")
+    worker.add_argument("--processes", type=int, default=1)
+    worker.add_argument("--lease", type=float, default=600, help="seconds before another worker may take over a running job")
+    worker.add_argument("--idle-exit", type=float, default=None, help="exit after this many idle seconds")
+    worker.add_argument("--analysis-server", default=SOCKET_PATH)
+    commands.add_parser("status", help="job counts per campaign and state")
+    args = parser.parse_args()
+
+    if args.command == "status":
+        for campaign, state, count in connect(args.db).execute(
+            "SELECT campaign, state, COUNT(*) FROM jobs GROUP BY campaign, state ORDER BY campaign, state"
+        ):
+            print(f"{campaign or '-'}\t{state}\t{count}")
+    elif args.processes > 1:
+        options = ["--lease", str(args.lease), "--analysis-server", args.analysis_server]
+        if args.idle_exit is not None:
+            options += ["--idle-exit", str(args.idle_exit)]
+        children = spawn(args.db, args.processes, options)
+        try:
+            for child in children:
+                child.wait()
+        except KeyboardInterrupt:
+            for child in children:
+                child.terminate()
+    else:
+        try:
+            work(args.db, args.lease, args.idle_exit, args.analysis_server)
+        except KeyboardInterrupt:
+            pass
@@ -0,0 +1,106 @@
+import json
+import os
+import shutil
+from dataclasses import asdict
+
+import diagnostics
+
+
+WORK_ROOT = "work"
+
+
+class Workspace:
+    # Scratch directory for a single question: its own source file, a
+    # compile_commands.json entry pointing at that file and the exported
+    # clang-tidy fixes, so several questions can be analyzed at once.
+    def __init__(self, index, root=WORK_ROOT, artifacts="", name=None):
+        self.index = index
+        self.artifacts = artifacts
+        self.dir = os.path.abspath(os.path.join(root, name or f"q{index}"))
+        self.source = os.path.join(self.dir, "ldd.c")
+        self.fixes = os.path.join(self.dir, "tidy_fixes.yaml")
+        self.compile_db = os.path.join(self.dir, "compile_commands.json")
+        self.build_log = os.path.join(self.dir, "build.log")
+        # Results of the latest analysis, kept in memory for the next prompt.
+        self.diagnostics = []
+        self.build_diagnostics = []
+        self.exported = {}
+        # Prompts and responses so far, journaled by checkpoints.
+        self.history = []
+
+    def prepare(self, template="compile_commands.json", makefile="Makefile"):
+        os.makedirs(self.dir, exist_ok=True)
+        shutil.copyfile(makefile, os.path.join(self.dir, "Makefile"))
+        with open(template, 'r') as f:
+            entry = dict(json.load(f)[0])
+
+        # The template was recorded by `bear -- make` for the top-level ldd.c;
+        # point it at this workspace's copy instead.
+        arguments = list(entry["arguments"])
+        arguments[-1] = self.source
+        entry["arguments"] = arguments
+        entry["directory"] = self.dir
+        entry["file"] = self.source
+        entry["output"] = os.path.join(self.dir, "ldd.o")
+
+        with open(self.compile_db, 'w') as f:
+            json.dump([entry], f, indent=2)
+        return self
+
+    def write_source(self, code):
+        with open(self.source, 'w') as f:
+            f.write(code)
+
+    def read_source(self):
+        with open(self.source, 'r') as f:
+            return f.read()
+
+    def snapshot(self):
+        return {
+            "source": self.read_source() if os.path.exists(self.source) else None,
+            "diagnostics": [asdict(record) for record in self.diagnostics],
+            "build_diagnostics": [asdict(record) for record in self.build_diagnostics],
+            "exported": self.exported,
+        }
+
+    def restore(self, snapshot):
+        if snapshot["source"] is not None:
+            self.write_source(snapshot["source"])
+        self.diagnostics = [diagnostics.from_dict(record) for record in snapshot["diagnostics"]]
+        self.build_diagnostics = [diagnostics.from_dict(record) for record in snapshot["build_diagnostics"]]
+        self.exported = snapshot["exported"]
+        self.history = list(snapshot.get("history", []))
+        return self
+
+    def candidate(self, k):
+        return Workspace(self.index, root=self.dir, artifacts=self.artifacts, name=f"candidate{k}")
+
+    def adopt(self, other):
+        # Take over another workspace's source and analysis results, e.g. the
+        # winning candidate of a best-of-N round.
+        for name in ("source", "fixes", "build_log"):
+            source, destination = getattr(other, name), getattr(self, name)
+            if os.path.exists(source):
+                with open(source, 'r') as f:
+                    content = f.read().replace(other.dir, self.dir)
+                with open(destination, 'w') as f:
+                    f.write(content)
+            elif os.path.exists(destination):
+                os.remove(destination)
+        # Paths into the candidate's directory would make the next prompt
+        # depend on which candidate won, and on whether its analysis came
+        # from the cache.
+        self.diagnostics = diagnostics.relocate(other.diagnostics, other.dir, self.dir)
+        self.build_diagnostics = diagnostics.relocate(other.build_diagnostics, other.dir, self.dir)
+        self.exported = diagnostics.load_fixes(self.fixes)
+
+    def publish(self):
+        # Keep the per-question artifacts where earlier runs left them; in a
+        # multi-model run each model gets its own subdirectory.
+        sources = os.path.join("temp_ldd", self.artifacts)
+        fixes = os.path.join("fixes", self.artifacts)
+        os.makedirs(sources, exist_ok=True)
+        os.makedirs(fixes, exist_ok=True)
+        shutil.copyfile(self.source, os.path.join(sources, f"ldd_{self.index}.c"))
+        if os.path.exists(self.fixes):
+            shutil.copyfile(self.fixes, os.path.join(fixes, f"tidy_fixes_{self.index}.yaml"))